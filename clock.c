@@ -21,9 +21,10 @@
  * You can verify this for yourself using gcc -v.
  *******************************************************/
 
-#if defined(__i386__)  
+#if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
  * Pentium versions of start_counter() and get_counter()
+ * (rdtsc leaves its result in edx:eax on x86-64 as well)
  *******************************************************/
 
 
@@ -1,6 +1,8 @@
 #ifndef __CONFIG_H_
 #define __CONFIG_H_
 
+#include <stddef.h>
+
 /*
  * config.h - malloc lab configuration file
  *
@@ -58,9 +60,13 @@
 #define ALIGNMENT 8
 
 /* 
- * Maximum heap size in bytes 
+ * Maximum heap size in bytes.  DEFAULT_MAX_HEAP can be overridden at
+ * runtime by setting max_heap (defined in memlib.c) before mem_init,
+ * e.g., with mdriver -H.
  */
-#define MAX_HEAP (20*(1<<20))  /* 20 MB */
+#define DEFAULT_MAX_HEAP (20*(1<<20))  /* 20 MB */
+#define MAX_HEAP max_heap
+extern size_t max_heap;
 
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
@@ -13,6 +13,7 @@
 
 #include "fcyc.h"
 #include "clock.h"
+#include "perfctr.h"
 
 /* Default values */
 #define K 3                  /* Value of K in K-best scheme */
@@ -167,6 +168,55 @@ double fcyc(test_funct f, void *argp)
     return result;  
 }
 
+/*
+ * fcyc_perfctr - Use the K-best scheme to estimate the hardware events of
+ *     function f.  Each event keeps its own K smallest counts, and samples
+ *     are taken until all of them have converged.  Events that cannot be
+ *     counted are returned as -1, and are left out of the convergence test.
+ */
+void fcyc_perfctr(test_funct f, void *argp, double *counts)
+{
+    double sample[NPERFCTRS], *best;
+    int c, pos, converged;
+
+    best = calloc(NPERFCTRS * kbest, sizeof(double));
+    if (!best) {
+	fprintf(stderr, "Fatal error.  Calloc returned null in fcyc_perfctr\n");
+	exit(1);
+    }
+    samplecount = 0;
+    do {
+	if (clear_cache)
+	    clear();
+	start_perfctr();
+	f(argp);
+	get_perfctr(sample);
+
+	/* Insert each count into its event's K best, as add_sample does */
+	converged = 1;
+	for (c = 0; c < NPERFCTRS; c++) {
+	    double *values = best + c * kbest;
+	    pos = samplecount < kbest ? samplecount : kbest-1;
+	    if (samplecount < kbest || sample[c] < values[kbest-1])
+		values[pos] = sample[c];
+	    while (pos > 0 && values[pos-1] > values[pos]) {
+		double temp = values[pos-1];
+		values[pos-1] = values[pos];
+		values[pos] = temp;
+		pos--;
+	    }
+	    if (values[0] >= 0 && (samplecount+1 < kbest || 
+		(1 + epsilon)*values[0] < values[kbest-1]))
+		converged = 0;
+	}
+	samplecount++;
+    } while (!converged && samplecount < maxsamples);
+
+    for (c = 0; c < NPERFCTRS; c++)
+	counts[c] = best[c * kbest];
+    free(best);
+}
+
 
 /*************************************************************
  * Set the various parameters used by the measurement routines 
@@ -13,6 +13,9 @@ typedef void (*test_funct)(void *);
 /* Compute number of cycles used by test function f */
 double fcyc(test_funct f, void* argp);
 
+/* Count the hardware events (see perfctr.h) of test function f */
+void fcyc_perfctr(test_funct f, void *argp, double *counts);
+
 /*********************************************************
  * Set the various parameters used by measurement routines 
  *********************************************************/
@@ -7,6 +7,7 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE  /* for sched_setaffinity */
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -15,12 +16,23 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
+#include "fcyc.h"
+#include "clock.h"
+#include "perfctr.h"
 #include "config.h"
+#include "trace.h"
 
 /**********************
  * Constants and macros
@@ -31,6 +43,34 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Threaded replay (-P) */
+#define NTHREADCOUNTS  5 /* number of thread counts we measure */
+#define MAXTHREADS    16 /* largest thread count, and heap size multiplier */
+#define PAR_RUNS       3 /* keep the best of this many runs per thread count */
+#define RINGSIZE    1024 /* frees a producer can queue for its consumer */
+#define BATCHMAX      64 /* most requests replayed as one batch with -B */
+
+/* Timing trials (-n) */
+#define MAXTRIALS     32 /* most timing trials per trace */
+
+/* Pointer chase (-w) */
+#define CHASE_MAXSIZE 512 /* largest block put on the pointer chase ring */
+#define CHASE_HOPS (1<<20) /* least hops of one timed walk of the ring */
+#define LINESIZE      64 /* cache line size (bytes) */
+#define PAGESIZE    4096 /* page size (bytes) */
+
+/* NUMA access (-N) */
+#define NUMA_BYTES (1<<28) /* least bytes one timed access run touches */
+
+/* 
+ * Latency histograms (-l).  Each power of two of cycles is split into
+ * 2^HIST_SUBBITS linear buckets, so a bucket is within 1/16 of its values.
+ */
+#define HIST_SUBBITS   4
+#define HIST_NBUCKETS  ((64 - HIST_SUBBITS + 1) << HIST_SUBBITS)
+#define NOPTYPES       3 /* ALLOC, FREE and REALLOC requests */
+#define NQUANTILES     4 /* p50, p99, p99.9 and max */
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((uintptr_t)(p)) % ALIGNMENT) == 0)
 
@@ -38,19 +78,24 @@
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload.  The ranges form a splay
+ * tree ordered by address, so that checking a block against its
+ * neighbors takes amortized logarithmic time even with a large live set.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges at lower addresses */
+    struct range_t *right; /* ranges at higher addresses */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/* Log-bucketed histogram of request latencies in cycles */
 typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+    unsigned long counts[HIST_NBUCKETS];
+    unsigned long total;      /* number of samples */
+    double max;               /* largest sample */
+} hist_t;
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -61,6 +106,8 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace file, or NULL */
+    size_t map_size;     /* bytes mapped */
 } trace_t;
 
 /* 
@@ -73,6 +120,13 @@ typedef struct {
     range_t *ranges;
 } speed_t;
 
+/* The ring of small blocks that eval_mm_chase_walk() follows */
+typedef struct {
+    char *head;
+    unsigned long hops;
+    uintptr_t sum;  /* of the words loaded, so that the loads are kept */
+} chase_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* defined for both libc malloc and student malloc package (mm.c) */
@@ -83,9 +137,96 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* per-request latency quantiles in cycles, by request type, with -l */
+    unsigned long lat_ops[NOPTYPES];
+    double lat[NOPTYPES][NQUANTILES];
+
+    /* Kops/sec at each of thread_counts[] threads, 0 on failure, with -P */
+    double par_kops[NTHREADCOUNTS];
+
+    /* Likewise for producer/consumer pairs of threads, with -C */
+    double pc_kops[NTHREADCOUNTS];
+
+    /* batched replay with -B: was it valid, allocator calls and secs */
+    int batch_valid;
+    double batch_calls;
+    double batch_secs;
+
+    /* allocator counters after the correctness replay, with -S */
+    struct mm_stats counters;
+
+    /* hardware events of one replay, K-best like secs, with -e */
+    double events[NPERFCTRS];
+
+    /* pointer chase over the small blocks live at the trace's peak, with
+       -w: blocks on the ring, the cache lines and pages their payloads
+       touch, how many straddle more lines than they need, and the secs
+       and LLC misses (-1 if not counted) per hop */
+    double chase_blocks;
+    double chase_lines;
+    double chase_pages;
+    double chase_straddle;
+    double chase_secs;
+    double chase_llc;
+
+    /* MB/s of passes over the blocks live at the trace's peak, with -N,
+       by threads on the NUMA node the blocks were allocated on and on
+       the other nodes (0 with only one node) */
+    double numa_local;
+    double numa_remote;
+
+    /* KB of the heap resident after the utilization replay, and of them
+       backed by transparent huge pages, with -T (-1 if unknown) */
+    double thp_resident;
+    double thp_huge;
+
+    /* secs of each timing trial with -n; secs is then the time at the
+       trials' mean Kops/sec */
+    int trials;
+    double trial_secs[MAXTRIALS];
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+/* The measurements to make of each trace, from the command line */
+typedef struct {
+    int latency;     /* measure per-request latency (-l) */
+    int batch;       /* measure batched replay (-B) */
+    int counters;    /* print the allocator's counters (-S) */
+    unsigned snaps;  /* snapshot the heap this often (-s) */
+    int trials;      /* timing trials per trace (-n) */
+    int events;      /* count hardware events (-e) */
+    int chase;       /* time a pointer chase over the small blocks (-w) */
+    unsigned checks; /* heap blocks to check after every request (-c) */
+} options_t;
+
+/* Queue of blocks a producer thread hands to its consumer to free */
+typedef struct {
+    char *slots[RINGSIZE];
+    unsigned head;                /* next slot to free, moved by the consumer */
+    unsigned tail;                /* next slot to fill, moved by the producer */
+    int done;                     /* set once the producer has finished */
+} ring_t;
+
+/* Holds the params of one thread of the threaded replay */
+typedef struct {
+    trace_t *trace;
+    char **blocks;                /* this thread's own blocks array */
+    pthread_barrier_t *barrier;   /* starts all threads at once */
+    ring_t *ring;                 /* producer/consumer queue, or NULL */
+    int failed;                   /* set if the allocator ran out of memory */
+    double start, end;            /* when this thread started and finished */
+} thread_t;
+
+/* Holds the params of one thread of the NUMA replay, pinned to a node */
+typedef struct {
+    trace_t *trace;
+    unsigned *sizes;              /* payload bytes of the blocks at the peak */
+    cpu_set_t cpus;               /* the CPUs of the thread's node */
+    double bytes;                 /* bytes the timed passes touched */
+    double secs;                  /* how long they took */
+} numa_t;
+
 /********************
  * Global variables
  *******************/
@@ -101,6 +242,9 @@ static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL
 };
 
+/* The thread counts at which the threaded replay is measured */
+static int thread_counts[NTHREADCOUNTS] = {1, 2, 4, 8, 16};
+
 
 /********************* 
  * Function prototypes 
@@ -111,19 +255,64 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *splay_range(range_t *t, char *lo);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static int map_trace(trace_t *trace, char *path);
+static void parse_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating correctnes, space utilization, and speed 
    of the student's malloc package in mm.c */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
+static void eval_trace(char *tracefile, int tracenum, stats_t *stats,
+		       options_t *opts);
+static void run_workers(char **tracefiles, int n, stats_t *stats,
+			options_t *opts, int nworkers);
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 unsigned checks);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void eval_mm_counters(stats_t *stats);
+static void eval_mm_snapshots(trace_t *trace, char *tracefile, 
+			      unsigned interval);
+static int eval_mm_batch_valid(trace_t *trace, int tracenum, range_t **ranges,
+			       stats_t *stats);
+static void eval_mm_batch(void *ptr);
+static unsigned batch_end(trace_t *trace, unsigned i);
+static void replay_peak(trace_t *trace, unsigned *sizes, char *caller);
+static void eval_mm_chase(trace_t *trace, stats_t *stats, int events);
+static void eval_mm_chase_walk(void *ptr);
+static int ulong_cmp(const void *a, const void *b);
+static void eval_mm_threads(trace_t *trace, stats_t *stats, int pipe);
+static void *replay_thread(void *arg);
+static void *consumer_thread(void *arg);
+static void eval_mm_numa(trace_t *trace, stats_t *stats);
+static int node_cpus(int node, cpu_set_t *cpus);
+static void *numa_alloc_thread(void *arg);
+static void *numa_access_thread(void *arg);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printthreads(int n, stats_t *stats, int pipe);
+static void printbatch(int n, stats_t *stats);
+static void printchase(int n, stats_t *stats);
+static void printnuma(int n, stats_t *stats);
+static void printhuge(int n, stats_t *stats);
+static void printcounters(int n, stats_t *stats);
+static void printtrials(int n, stats_t *stats);
+static void printperfctr(int n, stats_t *stats);
+static void writejson(char *file, char **tracefiles, int n, stats_t *stats,
+		      int events, double util, double throughput, 
+		      double perfindex);
+static void putjson(FILE *fp, const char *s);
+static double trial_ci(stats_t *stats);
+static double get_nsecs(void);
+static size_t parse_size(char *s);
+static void hist_add(hist_t *hist, double cycles);
+static double hist_quantile(hist_t *hist, double q);
 static void usage(void);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
@@ -139,12 +328,16 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
-    speed_t speed_params;      /* input parameters to the xx_speed routines */ 
+    options_t opts = {0, 0, 0, 0, 1, 0, 0, 0};  /* what to measure of each trace */
 
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int threads = 0;     /* If set, measure threaded throughput (-P) */
+    int pipes = 0;       /* If set, measure producer/consumer pairs (-C) */
+    int numa = 0;        /* If set, measure NUMA local/remote access (-N) */
+    int workers = 0;     /* If set, run traces in this many workers (-j) */
+    char *jsonfile = NULL;  /* If set, write the results here as JSON (-J) */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -153,7 +346,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "gf:t:avVh")) != EOF) {
+    while ((c = getopt(argc, argv, "gf:t:avVhlPCNBSs:j:n:J:eH:wc:T")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -176,6 +369,68 @@ int main(int argc, char **argv)
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+	case 'l': /* Report the per-request latency distribution */
+	    opts.latency = 1;
+	    break;
+	case 'P': /* Replay each trace from several threads at once */
+	    if (!MM_THREADS)
+		app_error("ERROR: -P needs mm.c to be built with MM_THREADS");
+	    threads = 1;
+	    break;
+	case 'N': /* Access each trace's blocks from every NUMA node */
+	    if (!MM_THREADS)
+		app_error("ERROR: -N needs mm.c to be built with MM_THREADS");
+	    numa = 1;
+	    break;
+	case 'B': /* Replay each trace with batched malloc and free calls */
+	    opts.batch = 1;
+	    break;
+	case 'w': /* Walk the small blocks live at each trace's peak */
+	    opts.chase = 1;
+	    break;
+	case 'c': /* Check part of the heap after every request */
+	    if ((opts.checks = atoi(optarg)) == 0)
+		app_error("ERROR: -c needs a positive number of blocks");
+	    break;
+	case 's': /* Snapshot the heap every so many requests */
+	    if ((opts.snaps = atoi(optarg)) == 0)
+		app_error("ERROR: -s needs a positive request interval");
+	    break;
+	case 'S': /* Print what the allocator did during each trace */
+	    if (!MM_STATS)
+		app_error("ERROR: -S needs mm.c to be built with MM_STATS");
+	    opts.counters = 1;
+	    break;
+	case 'C': /* Replay each trace split across producers and consumers */
+	    if (!MM_THREADS)
+		app_error("ERROR: -C needs mm.c to be built with MM_THREADS");
+	    pipes = 1;
+	    break;
+	case 'j': /* Run the traces in parallel, pinned worker processes */
+	    if ((workers = atoi(optarg)) <= 0)
+		app_error("ERROR: -j needs a positive number of workers");
+	    break;
+	case 'n': /* Time each trace this many times */
+	    opts.trials = atoi(optarg);
+	    if (opts.trials <= 0 || opts.trials > MAXTRIALS) {
+		sprintf(msg, "ERROR: -n needs between 1 and %d trials", 
+			MAXTRIALS);
+		app_error(msg);
+	    }
+	    break;
+	case 'H': /* Size of the simulated heap */
+	    if ((max_heap = parse_size(optarg)) == 0)
+		app_error("ERROR: -H needs a heap size, e.g., 64M or 4G");
+	    break;
+	case 'T': /* Back the heap with transparent huge pages */
+	    mem_hugepages = 1;
+	    break;
+	case 'e': /* Count hardware events during the timed replays */
+	    opts.events = 1;
+	    break;
+	case 'J': /* Write the results to a JSON file */
+	    jsonfile = optarg;
+	    break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -229,6 +484,8 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (opts.events && init_perfctr(verbose) == 0)
+	app_error("ERROR: -e could not open any perf_event counters");
 
     /*
      * Always run and evaluate the student's mm package
@@ -245,23 +502,45 @@ int main(int argc, char **argv)
     mem_init(); 
 
     /* Evaluate student's mm malloc package using the K-best scheme */
-    for (i=0; i < num_tracefiles; i++) {
-	trace = read_trace(tracedir, tracefiles[i]);
-	mm_stats[i].ops = trace->num_ops;
-	if (verbose > 1)
-	    printf("Checking mm_malloc for correctness, ");
-	mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-	if (mm_stats[i].valid) {
-	    if (verbose > 1)
-		printf("efficiency, ");
-	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
-	    speed_params.trace = trace;
-	    speed_params.ranges = ranges;
-	    if (verbose > 1)
-		printf("and performance.\n");
-	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+    if (workers)
+	run_workers(tracefiles, num_tracefiles, mm_stats, &opts, workers);
+    else
+	for (i=0; i < num_tracefiles; i++)
+	    eval_trace(tracefiles[i], i, &mm_stats[i], &opts);
+
+    /* 
+     * Replay the valid traces from several threads at once.  Every thread
+     * needs the trace's whole footprint, so give each its own arena.
+     */
+    if (threads || pipes) {
+	mem_deinit();
+	mem_init_arenas(MAXTHREADS, MAX_HEAP);
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (threads)
+		eval_mm_threads(trace, &mm_stats[i], 0);
+	    if (pipes)
+		eval_mm_threads(trace, &mm_stats[i], 1);
+	    free_trace(trace);
+	}
+    }
+
+    /*
+     * Replay the valid traces on each NUMA node and access their blocks
+     * from every node.  Each node gets an arena bound to it.
+     */
+    if (numa) {
+	mem_deinit();
+	mem_init_arenas(mem_nodes(), MAX_HEAP);
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_numa(trace, &mm_stats[i]);
+	    free_trace(trace);
 	}
-	free_trace(trace);
     }
 
     /* Display the mm results in a compact table */
@@ -270,6 +549,58 @@ int main(int argc, char **argv)
 	printresults(num_tracefiles, mm_stats);
 	printf("\n");
     }
+    if (opts.trials > 1) {
+	printf("\nTiming trials for mm malloc (Kops/sec):\n");
+	printtrials(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (opts.events) {
+	printf("\nHardware events per request for mm malloc:\n");
+	printperfctr(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (opts.latency) {
+	printf("\nPer-request latency for mm malloc (cycles):\n");
+	printlatency(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (opts.batch) {
+	printf("\nBatched replay for mm malloc:\n");
+	printbatch(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (opts.chase) {
+	printf("\nPointer chase over the small blocks live at the peak:\n");
+	printchase(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (opts.counters) {
+	printf("\nAllocator counters for mm malloc:\n");
+	printcounters(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (threads) {
+	printf("\nThreaded throughput for mm malloc (Kops/sec):\n");
+	printthreads(num_tracefiles, mm_stats, 0);
+	printf("\n");
+    }
+    if (pipes) {
+	printf("\nProducer/consumer throughput for mm malloc (Kops/sec):\n");
+	printthreads(num_tracefiles, mm_stats, 1);
+	printf("\n");
+    }
+    if (numa) {
+	printf("\nAccess throughput over the blocks live at the peak, %d NUMA "
+	       "node%s (MB/s):\n", mem_nodes(), mem_nodes() > 1 ? "s" : "");
+	printnuma(num_tracefiles, mm_stats);
+	printf("\n");
+    }
+    if (mem_hugepages) {
+	printf("\nHeap backed by transparent huge pages after the "
+	       "utilization replay:\n");
+	printhuge(num_tracefiles, mm_stats);
+	printf("\n");
+    }
 
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
@@ -314,6 +645,10 @@ int main(int argc, char **argv)
 	printf("Terminated with %d errors\n", errors);
     }
 
+    if (jsonfile)
+	writejson(jsonfile, tracefiles, num_tracefiles, mm_stats, opts.events,
+		  avg_mm_util, secs > 0 ? ops/secs : 0, perfindex);
+
     if (autograder) {
 	printf("correct:%d\n", numcorrect);
 	printf("perfidx:%.0f\n", perfindex);
@@ -323,6 +658,161 @@ int main(int argc, char **argv)
 }
 
 
+/*
+ * eval_trace - Evaluate the mm malloc package on one trace: check it for
+ *     correctness, and if it is correct measure its utilization and time
+ *     it, along with whatever else opts asks for.
+ */
+static void eval_trace(char *tracefile, int tracenum, stats_t *stats,
+		       options_t *opts)
+{
+    trace_t *trace;
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    double kops;
+    size_t resident, huge;
+    int t;
+
+    trace = read_trace(tracedir, tracefile);
+    stats->ops = trace->num_ops;
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, ");
+    stats->valid = eval_mm_valid(trace, tracenum, &ranges, opts->checks);
+    if (stats->valid && opts->counters)
+	eval_mm_counters(stats);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("efficiency, ");
+	stats->util = eval_mm_util(trace, tracenum, &ranges);
+	stats->thp_resident = stats->thp_huge = -1;
+	if (mem_hugepages && mem_hugepage_usage(&resident, &huge) == 0) {
+	    stats->thp_resident = resident;
+	    stats->thp_huge = huge;
+	}
+	speed_params.trace = trace;
+	speed_params.ranges = ranges;
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stats->trials = opts->trials;
+	kops = 0;
+	for (t = 0; t < opts->trials; t++) {
+	    stats->trial_secs[t] = fsecs(eval_mm_speed, &speed_params);
+	    kops += stats->ops / 1e3 / stats->trial_secs[t] / opts->trials;
+	}
+	stats->secs = stats->ops / 1e3 / kops;  /* at the mean Kops/sec */
+	if (opts->events)
+	    fcyc_perfctr(eval_mm_speed, &speed_params, stats->events);
+	if (opts->latency)
+	    eval_mm_latency(trace, stats);
+	if (opts->batch) {
+	    stats->batch_valid = 
+		eval_mm_batch_valid(trace, tracenum, &ranges, stats);
+	    if (stats->batch_valid)
+		stats->batch_secs = fsecs(eval_mm_batch, &speed_params);
+	}
+	if (opts->snaps)
+	    eval_mm_snapshots(trace, tracefile, opts->snaps);
+	if (opts->chase)
+	    eval_mm_chase(trace, stats, opts->events);
+    }
+    clear_ranges(&ranges);
+    free_trace(trace);
+}
+
+/*
+ * run_workers - Evaluate each trace in a worker process of its own, with
+ *     up to nworkers of them at a time, each pinned to one of our CPUs, so
+ *     that traces neither wait for nor disturb each other and a crash
+ *     takes down only its own trace.  A worker sends its stats_t and its
+ *     error count back over a pipe.
+ */
+static void run_workers(char **tracefiles, int n, stats_t *stats,
+			options_t *opts, int nworkers)
+{
+    cpu_set_t allowed, cpu;
+    int *cpus, ncpus = 0;
+    pid_t *pids, pid;
+    int *fds, *traces;
+    int fd[2], next = 0, running = 0, slot, status, i;
+    int worker_errors;
+    stats_t result;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	unix_error("sched_getaffinity failed in run_workers");
+    if ((cpus = malloc(CPU_SETSIZE * sizeof(int))) == NULL ||
+	(pids = calloc(nworkers, sizeof(pid_t))) == NULL ||
+	(fds = malloc(nworkers * sizeof(int))) == NULL ||
+	(traces = malloc(nworkers * sizeof(int))) == NULL)
+	unix_error("malloc failed in run_workers");
+    for (i = 0; i < CPU_SETSIZE; i++)
+	if (CPU_ISSET(i, &allowed))
+	    cpus[ncpus++] = i;
+    if (nworkers > ncpus)
+	printf("Warning: %d workers share %d CPUs, so their timings will "
+	       "suffer\n", nworkers, ncpus);
+
+    while (next < n || running > 0) {
+	/* Start workers in the free slots */
+	for (slot = 0; slot < nworkers && next < n; slot++) {
+	    if (pids[slot] != 0)
+		continue;
+	    if (pipe(fd) < 0)
+		unix_error("pipe failed in run_workers");
+	    fflush(stdout);
+	    if ((pid = fork()) < 0)
+		unix_error("fork failed in run_workers");
+	    if (pid == 0) {
+		close(fd[0]);
+		CPU_ZERO(&cpu);
+		CPU_SET(cpus[slot % ncpus], &cpu);
+		if (sched_setaffinity(0, sizeof(cpu), &cpu) < 0)
+		    unix_error("sched_setaffinity failed in run_workers");
+		errors = 0;
+		eval_trace(tracefiles[next], next, &stats[next], opts);
+		if (write(fd[1], &stats[next], sizeof(stats_t)) != 
+		    sizeof(stats_t) ||
+		    write(fd[1], &errors, sizeof(int)) != sizeof(int))
+		    unix_error("write failed in run_workers");
+		fflush(stdout);
+		_exit(0);
+	    }
+	    close(fd[1]);
+	    pids[slot] = pid;
+	    fds[slot] = fd[0];
+	    traces[slot] = next++;
+	    running++;
+	}
+
+	/* Collect the result of the next worker to finish */
+	if ((pid = waitpid(-1, &status, 0)) < 0)
+	    unix_error("waitpid failed in run_workers");
+	for (slot = 0; slot < nworkers && pids[slot] != pid; slot++)
+	    ;
+	if (slot == nworkers)
+	    continue;
+	if (read(fds[slot], &result, sizeof(stats_t)) == sizeof(stats_t) &&
+	    read(fds[slot], &worker_errors, sizeof(int)) == sizeof(int)) {
+	    stats[traces[slot]] = result;
+	    errors += worker_errors;
+	} else {
+	    errors++;
+	    if (WIFSIGNALED(status))
+		printf("ERROR [trace %d]: worker killed by signal %d\n",
+		       traces[slot], WTERMSIG(status));
+	    else
+		printf("ERROR [trace %d]: worker exited with status %d\n",
+		       traces[slot], WEXITSTATUS(status));
+	}
+	close(fds[slot]);
+	pids[slot] = 0;
+	running--;
+    }
+    free(cpus);
+    free(pids);
+    free(fds);
+    free(traces);
+}
+
 /*****************************************************************
  * The following routines manipulate the range list, which keeps 
  * track of the extent of every allocated block payload. We use the 
@@ -339,7 +829,7 @@ static int add_range(range_t **ranges, char *lo, int size,
 		     int tracenum, int opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *prev, *next;
     char msg[MAXLINE];
 
     assert(size > 0);
@@ -361,26 +851,53 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    /* 
+     * The payload must not overlap any other payloads, which holds if it 
+     * overlaps neither the range at the next lower address nor the one at
+     * the next higher address.  Splaying lo brings one of them to the
+     * root, and splaying its other subtree brings up the other.
+     */
+    prev = next = NULL;
+    if ((p = *ranges = splay_range(*ranges, lo)) != NULL) {
+	if (p->lo <= lo) {
+	    prev = p;
+	    next = p->right = splay_range(p->right, lo);
+	} else {
+	    next = p;
+	    prev = p->left = splay_range(p->left, lo);
+	}
+    }
+    if (prev != NULL && prev->hi >= lo)
+	p = prev;
+    else if (next != NULL && next->lo <= hi)
+	p = next;
+    else
+	p = NULL;
+    if (p != NULL) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and making it the root of the tree.
      */
     if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
 	unix_error("malloc error in add_range");
-    p->next = *ranges;
     p->lo = lo;
     p->hi = hi;
+    p->left = p->right = NULL;
+    if (*ranges != NULL && (*ranges)->lo < lo) {
+	p->left = *ranges;
+	p->right = (*ranges)->right;
+	(*ranges)->right = NULL;
+    } else if (*ranges != NULL) {
+	p->right = *ranges;
+	p->left = (*ranges)->left;
+	(*ranges)->left = NULL;
+    }
     *ranges = p;
     return 1;
 }
@@ -393,18 +910,18 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    //int size;
-
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            //size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+
+    if ((p = *ranges = splay_range(*ranges, lo)) == NULL || p->lo != lo)
+	return;
+
+    /* The largest range below lo takes its place, as it has no right child */
+    if (p->left == NULL)
+	*ranges = p->right;
+    else {
+	*ranges = splay_range(p->left, lo);
+	(*ranges)->right = p->right;
     }
+    free(p);
 }
 
 /*
@@ -415,13 +932,77 @@ static void clear_ranges(range_t **ranges)
     range_t *p;
     range_t *pnext;
 
+    /* Rotate left children up, so that the walk needs no stack */
     for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+	if ((pnext = p->left) != NULL) {
+	    p->left = pnext->right;
+	    pnext->right = p;
+	} else {
+	    pnext = p->right;
+	    free(p);
+	}
     }
     *ranges = NULL;
 }
 
+/*
+ * splay_range - Splay the tree of ranges t at lo, top down, and return its
+ *     new root: the range starting at lo if there is one, and otherwise
+ *     the range at the next lower or the next higher address
+ */
+static range_t *splay_range(range_t *t, char *lo)
+{
+    range_t head, *l, *r, *y;
+
+    if (t == NULL)
+	return t;
+    head.left = head.right = NULL;
+    l = r = &head;
+    for (;;) {
+	if (lo < t->lo) {
+	    if (t->left == NULL)
+		break;
+	    if (lo < t->left->lo) {
+		/* Rotate right */
+		y = t->left;
+		t->left = y->right;
+		y->right = t;
+		t = y;
+		if (t->left == NULL)
+		    break;
+	    }
+	    /* Link right */
+	    r->left = t;
+	    r = t;
+	    t = t->left;
+	} else if (lo > t->lo) {
+	    if (t->right == NULL)
+		break;
+	    if (lo > t->right->lo) {
+		/* Rotate left */
+		y = t->right;
+		t->right = y->left;
+		y->left = t;
+		t = y;
+		if (t->right == NULL)
+		    break;
+	    }
+	    /* Link left */
+	    l->right = t;
+	    l = t;
+	    t = t->right;
+	} else
+	    break;
+    }
+
+    /* Assemble */
+    l->right = t->left;
+    r->left = t->right;
+    t->left = head.right;
+    t->right = head.left;
+    return t;
+}
+
 
 /**********************************************
  * The following routines manipulate tracefiles
@@ -432,13 +1013,8 @@ static void clear_ranges(range_t **ranges)
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
     char path[MAXLINE];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
 
     if (verbose > 1)
 	printf("Reading tracefile: %s\n", filename);
@@ -446,10 +1022,40 @@ static trace_t *read_trace(char *tracedir, char *filename)
     /* Allocate the trace record */
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
 	unix_error("malloc 1 failed in read_trance");
+    trace->map = NULL;
+    trace->map_size = 0;
 	
-    /* Read the trace file header */
+    /* A binary trace is replayed straight from its mapping */
     strcpy(path, tracedir);
     strcat(path, filename);
+    if (!map_trace(trace, path))
+	parse_trace(trace, path);
+
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+	unix_error("malloc 3 failed in read_trace");
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc 4 failed in read_trace");
+    
+    return trace;
+}
+
+/*
+ * parse_trace - Read the text trace file at path into trace
+ */
+static void parse_trace(trace_t *trace, char *path)
+{
+    FILE *tracefile;
+    char type[MAXLINE];
+    unsigned index, size;
+    unsigned max_index = 0;
+    unsigned op_index;
+
+    /* Read the trace file header */
     if ((tracefile = fopen(path, "r")) == NULL) {
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
@@ -464,16 +1070,6 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	 (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
 	unix_error("malloc 2 failed in read_trace");
 
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks = 
-	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-	unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes = 
-	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-	unix_error("malloc 4 failed in read_trace");
-    
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
@@ -509,17 +1105,66 @@ static trace_t *read_trace(char *tracedir, char *filename)
     fclose(tracefile);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
-    
-    return trace;
+}
+
+/*
+ * map_trace - If the file at path is a binary trace, map it and point the
+ *     trace's requests into the mapping, so that nothing is parsed or
+ *     copied and a trace larger than memory is paged in as it is
+ *     replayed.  Returns 1 if the file is a binary trace, 0 otherwise.
+ */
+static int map_trace(trace_t *trace, char *path)
+{
+    tracehdr_t *hdr;
+    struct stat st;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) < 0) {
+	sprintf(msg, "Could not open %s in read_trace", path);
+	unix_error(msg);
+    }
+    if (fstat(fd, &st) < 0)
+	unix_error("fstat failed in map_trace");
+    if ((size_t)st.st_size < sizeof(tracehdr_t)) {
+	close(fd);
+	return 0;
+    }
+    hdr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    if (hdr->magic != TRACE_MAGIC) {
+	munmap(hdr, st.st_size);
+	return 0;
+    }
+    if (hdr->version != TRACE_VERSION || (size_t)st.st_size != 
+	sizeof(tracehdr_t) + (size_t)hdr->num_ops * sizeof(traceop_t)) {
+	sprintf(msg, "Bad binary trace %s in read_trace", path);
+	app_error(msg);
+    }
+
+    /* Each replay reads the requests once from start to end */
+    madvise(hdr, st.st_size, MADV_SEQUENTIAL);
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+    trace->map = hdr;
+    trace->map_size = st.st_size;
+    return 1;
 }
 
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated or mapped in read_trace().
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -531,9 +1176,12 @@ void free_trace(trace_t *trace)
  **********************************************************************/
 
 /*
- * eval_mm_valid - Check the mm malloc package for correctness
+ * eval_mm_valid - Check the mm malloc package for correctness, and
+ *     if checks is not zero, have mm_check verify that many heap blocks
+ *     after every request
  */
-static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) 
+static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges,
+			 unsigned checks) 
 {
     unsigned i, j;
     int index;
@@ -612,7 +1260,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -637,6 +1285,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_valid");
         }
 
+	if (checks > 0 && mm_check(checks) > 0) {
+	    malloc_error(tracenum, i, "mm_check found the heap corrupt.");
+	    return 0;
+	}
     }
 
     /* As far as we know, this is a valid malloc package */
@@ -661,6 +1313,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
     unsigned size, newsize, oldsize;
     int max_total_size = 0;
     int total_size = 0;
+    size_t max_heap_size = 0;
     char *p;
     char *newp, *oldp;
 
@@ -735,9 +1388,13 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
 	    app_error("Nonexistent request type in eval_mm_util");
 
         }
+
+	/* The heap can shrink when mappings are released, so track the peak */
+	if (mem_heapsize() > max_heap_size)
+	    max_heap_size = mem_heapsize();
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)max_heap_size);
 }
 
 
@@ -788,68 +1445,1306 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
-
-
 /*
- * printresults - prints a performance summary for some malloc package
+ * eval_mm_latency - Replay the trace once more, timing every request on
+ *    its own with the cycle counter, and record the quantiles of the
+ *    latencies of each type of request.  The cost of reading the counter,
+ *    as measured by ovhd(), is taken off every sample.
  */
-static void printresults(int n, stats_t *stats) 
+static void eval_mm_latency(trace_t *trace, stats_t *stats)
 {
-    int i;
-    double secs = 0;
-    double ops = 0;
-    double util = 0;
+    unsigned i, index, n = trace->num_ops;
+    static const double quantiles[NQUANTILES] = {0.5, 0.99, 0.999, 1.0};
+    double overhead, cycles;
+    hist_t *hist;
+    int t, q;
+    char *p;
 
-    /* Print the individual results for each trace */
-    /* All the space before the last number on each line is added by 
-     * Zheng Cai, for better formatting */
-    printf("%5s%7s %5s%8s%10s %6s\n", 
-	   "trace", " valid", "util", "ops", "secs", "Kops");
-    for (i=0; i < n; i++) {
-	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f %6.0f\n", 
-		   i,
-		   "yes",
-		   stats[i].util*100.0,
-		   stats[i].ops,
-		   stats[i].secs,
-		   (stats[i].ops/1e3)/stats[i].secs);
-	    secs += stats[i].secs;
-	    ops += stats[i].ops;
-	    util += stats[i].util;
-	}
-	else {
-	    printf("%2d%10s%6s%8s%10s %6s\n", 
-		   i,
-		   "no",
-		   "-",
-		   "-",
-		   "-",
-		   "-");
-	}
-    }
+    if ((hist = (hist_t *)calloc(NOPTYPES, sizeof(hist_t))) == NULL)
+	unix_error("calloc failed in eval_mm_latency");
 
-    /* Print the aggregate results for the set of traces */
-    if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f %6.0f\n", 
-	       "Total       ",
-	       (util/n)*100.0,
-	       ops, 
-	       secs,
-	       (ops/1e3)/secs);
-    }
-    else {
-	printf("%12s%6s%8s%10s %6s\n", 
-	       "Total       ",
-	       "-", 
-	       "-", 
-	       "-", 
-	       "-");
+    /* Take the least overhead seen, so no sample is over-corrected */
+    overhead = ovhd();
+    for (t = 0; t < 100; t++) {
+	if ((cycles = ovhd()) < overhead)
+	    overhead = cycles;
     }
 
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < n;  i++) {
+	index = trace->ops[i].index;
+	start_counter();
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(trace->blocks[index], 
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(trace->blocks[index]);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+        }
+	cycles = get_counter() - overhead;
+	hist_add(&hist[trace->ops[i].type], cycles > 0 ? cycles : 0);
+    }
+
+    /* Read off the quantiles of each request type */
+    for (t = 0; t < NOPTYPES; t++) {
+	stats->lat_ops[t] = hist[t].total;
+	for (q = 0; q < NQUANTILES; q++)
+	    stats->lat[t][q] = hist_quantile(&hist[t], quantiles[q]);
+    }
+    free(hist);
+}
+
+/*
+ * eval_mm_snapshots - Replay the trace once more, writing a snapshot of
+ *    the heap to <trace>.snap in the current directory after every
+ *    "interval" requests and after the last one.  Each snapshot is
+ *    labelled with the number of requests done.
+ */
+static void eval_mm_snapshots(trace_t *trace, char *tracefile, 
+			      unsigned interval)
+{
+    unsigned i, index, n = trace->num_ops;
+    char name[MAXLINE], *base, *ext;
+    FILE *fp;
+    char *p;
+
+    /* Name the snapshot file after the trace, less its directory */
+    base = strrchr(tracefile, '/');
+    snprintf(name, sizeof(name) - 5, "%s", base != NULL ? base + 1 : tracefile);
+    if ((ext = strrchr(name, '.')) != NULL && strcmp(ext, ".rep") == 0)
+	*ext = '\0';
+    strcat(name, ".snap");
+    if ((fp = fopen(name, "wb")) == NULL)
+	unix_error("fopen failed in eval_mm_snapshots");
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_snapshots");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < n;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		app_error("mm_malloc error in eval_mm_snapshots");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(trace->blocks[index], 
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in eval_mm_snapshots");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(trace->blocks[index]);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_snapshots");
+        }
+	if (((i + 1) % interval == 0 || i + 1 == n) && 
+	    mm_snapshot(fp, i + 1) != 0)
+	    unix_error("mm_snapshot failed in eval_mm_snapshots");
+    }
+
+    if (fclose(fp) != 0)
+	unix_error("fclose failed in eval_mm_snapshots");
+    if (verbose > 1)
+	printf("Wrote %s\n", name);
+}
+
+/*
+ * eval_mm_counters - Record the allocator's counters, which describe the
+ *    correctness replay that eval_mm_valid has just done
+ */
+static void eval_mm_counters(stats_t *stats)
+{
+    mm_stats(&stats->counters);
+}
+
+/*
+ * batch_end - Returns the end of the batch of requests that starts at
+ *    request i: a run of allocations of the same size or a run of frees,
+ *    of at most BATCHMAX requests.  A reallocation is a batch of its own.
+ */
+static unsigned batch_end(trace_t *trace, unsigned i)
+{
+    traceop_t *ops = trace->ops;
+    unsigned j = i + 1;
+
+    if (ops[i].type == REALLOC)
+	return j;
+    while (j < trace->num_ops && j - i < BATCHMAX && 
+	   ops[j].type == ops[i].type &&
+	   (ops[i].type == FREE || ops[j].size == ops[i].size))
+	j++;
+    return j;
+}
+
+/*
+ * eval_mm_batch_valid - Check the batched replay of the trace for
+ *    correctness like eval_mm_valid, making sure that the blocks of a
+ *    batch do not overlap and keep their data until they are freed.  Also
+ *    count the allocator calls of the batched replay.
+ */
+static int eval_mm_batch_valid(trace_t *trace, int tracenum, range_t **ranges,
+			       stats_t *stats)
+{
+    unsigned i, j, k, n, size;
+    int index;
+    char *p, *ptrs[BATCHMAX];
+
+    /* Reset the heap and free any records in the range list */
+    mem_reset_brk();
+    clear_ranges(ranges);
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	return 0;
+    }
+
+    stats->batch_calls = 0;
+    for (i = 0;  i < trace->num_ops;  i = j) {
+	j = batch_end(trace, i);
+	n = j - i;
+	stats->batch_calls++;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc_batch */
+	    size = trace->ops[i].size;
+	    if (mm_malloc_batch(size, n, (void **)ptrs) != n) {
+		malloc_error(tracenum, i, "mm_malloc_batch failed.");
+		return 0;
+	    }
+	    for (k = i; k < j; k++) {
+		index = trace->ops[k].index;
+		p = ptrs[k - i];
+		if (add_range(ranges, p, size, tracenum, k) == 0)
+		    return 0;
+		memset(p, index & 0xFF, size);
+		trace->blocks[index] = p;
+		trace->block_sizes[index] = size;
+	    }
+	    break;
+
+        case REALLOC: /* mm_realloc */
+	    index = trace->ops[i].index;
+	    size = trace->ops[i].size;
+	    if ((p = mm_realloc(trace->blocks[index], size)) == NULL) {
+		malloc_error(tracenum, i, "mm_realloc failed.");
+		return 0;
+	    }
+	    remove_range(ranges, trace->blocks[index]);
+	    if (add_range(ranges, p, size, tracenum, i) == 0)
+		return 0;
+	    memset(p, index & 0xFF, size);
+	    trace->blocks[index] = p;
+	    trace->block_sizes[index] = size;
+	    break;
+
+        case FREE: /* mm_free_batch */
+	    for (k = i; k < j; k++) {
+		index = trace->ops[k].index;
+		p = trace->blocks[index];
+		for (size = 0; size < trace->block_sizes[index]; size++) {
+		    if ((unsigned char)p[size] != (index & 0xFF)) {
+			malloc_error(tracenum, k, "block data was overwritten "
+				     "before it was freed");
+			return 0;
+		    }
+		}
+		remove_range(ranges, p);
+		ptrs[k - i] = p;
+	    }
+	    mm_free_batch((void **)ptrs, n);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_batch_valid");
+        }
+    }
+    return 1;
+}
+
+/*
+ * eval_mm_batch - Like eval_mm_speed, but replays runs of allocations of
+ *    the same size and runs of frees with one mm_malloc_batch or 
+ *    mm_free_batch call each.  Timed by fcyc.
+ */
+static void eval_mm_batch(void *ptr)
+{
+    unsigned i, j, k, n;
+    char *p, *ptrs[BATCHMAX];
+    trace_t *trace = ((speed_t *)ptr)->trace;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_batch");
+
+    for (i = 0;  i < trace->num_ops;  i = j) {
+	j = batch_end(trace, i);
+	n = j - i;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc_batch */
+	    if (mm_malloc_batch(trace->ops[i].size, n, (void **)ptrs) != n)
+		app_error("mm_malloc_batch error in eval_mm_batch");
+	    for (k = i; k < j; k++)
+		trace->blocks[trace->ops[k].index] = ptrs[k - i];
+	    break;
+
+	case REALLOC: /* mm_realloc */
+	    if ((p = mm_realloc(trace->blocks[trace->ops[i].index], 
+				trace->ops[i].size)) == NULL)
+		app_error("mm_realloc error in eval_mm_batch");
+	    trace->blocks[trace->ops[i].index] = p;
+	    break;
+
+        case FREE: /* mm_free_batch */
+	    for (k = i; k < j; k++)
+		ptrs[k - i] = trace->blocks[trace->ops[k].index];
+	    mm_free_batch((void **)ptrs, n);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_batch");
+        }
+    }
+}
+
+/*
+ * replay_peak - Replay the trace up to the request after which the most
+ *    blocks are live, on a fresh heap, and set sizes[id] to the payload
+ *    size of each block then live, or 0.  The blocks are left in
+ *    trace->blocks.
+ */
+static void replay_peak(trace_t *trace, unsigned *sizes, char *caller)
+{
+    unsigned i, index, peak = 0;
+    long live = 0, maxlive = -1;
+    char *p;
+
+    /* Find the peak of the live blocks */
+    for (i = 0; i < trace->num_ops; i++) {
+	if (trace->ops[i].type == ALLOC)
+	    live++;
+	else if (trace->ops[i].type == FREE)
+	    live--;
+	if (live > maxlive) {
+	    maxlive = live;
+	    peak = i;
+	}
+    }
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	sprintf(msg, "mm_init failed in %s", caller);
+	app_error(msg);
+    }
+
+    /* Interpret the trace requests up to the peak */
+    for (i = 0;  i <= peak && i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL) {
+		sprintf(msg, "mm_malloc error in %s", caller);
+		app_error(msg);
+	    }
+            trace->blocks[index] = p;
+	    sizes[index] = trace->ops[i].size;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(trace->blocks[index], 
+				trace->ops[i].size)) == NULL) {
+		sprintf(msg, "mm_realloc error in %s", caller);
+		app_error(msg);
+	    }
+            trace->blocks[index] = p;
+	    sizes[index] = trace->ops[i].size;
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(trace->blocks[index]);
+	    sizes[index] = 0;
+            break;
+
+	default:
+	    sprintf(msg, "Nonexistent request type in %s", caller);
+	    app_error(msg);
+        }
+    }
+}
+
+/*
+ * eval_mm_chase - Replay the trace up to the request after which the most
+ *    blocks are live, then link every live block of at most CHASE_MAXSIZE
+ *    bytes into a ring in id order, i.e., roughly in the order they were
+ *    allocated, the way a program builds a list of small objects.  Count
+ *    the cache lines and pages their payloads touch, and time a walk of
+ *    the ring that loads the first and last word of every block.
+ */
+static void eval_mm_chase(trace_t *trace, stats_t *stats, int events)
+{
+    unsigned index, size;
+    unsigned *sizes;
+    unsigned long *lines, *pages, nlines = 0, nblocks = 0, lo, hi, k;
+    double counts[NPERFCTRS];
+    char *p, *prev = NULL;
+    chase_t chase;
+
+    if ((sizes = (unsigned *)calloc(trace->num_ids, sizeof(unsigned))) == NULL)
+	unix_error("calloc failed in eval_mm_chase");
+    replay_peak(trace, sizes, "eval_mm_chase");
+
+    /* Make room for every line that a small block touches */
+    for (index = 0; index < trace->num_ids; index++) {
+	size = sizes[index];
+	if (size >= 2 * sizeof(void *) && size <= CHASE_MAXSIZE) {
+	    p = trace->blocks[index];
+	    nlines += ((uintptr_t)p + size - 1) / LINESIZE - 
+		(uintptr_t)p / LINESIZE + 1;
+	}
+    }
+    if ((lines = (unsigned long *)malloc(nlines * sizeof(long))) == NULL ||
+	(pages = (unsigned long *)malloc(nlines * sizeof(long))) == NULL)
+	unix_error("malloc failed in eval_mm_chase");
+
+    /* 
+     * Link the small blocks into a ring.  The first word of a block points
+     * to the next one, and the second holds the offset of its last word.
+     * Note the lines and pages they touch, and whether they straddle more
+     * lines than they need.
+     */
+    nlines = 0;
+    stats->chase_straddle = 0;
+    for (index = 0; index < trace->num_ids; index++) {
+	size = sizes[index];
+	if (size < 2 * sizeof(void *) || size > CHASE_MAXSIZE)
+	    continue;
+	p = trace->blocks[index];
+	((uintptr_t *)p)[1] = (size - 1) & ~(sizeof(void *) - 1);
+	if (prev != NULL)
+	    *(char **)prev = p;
+	else
+	    chase.head = p;
+	prev = p;
+	nblocks++;
+
+	lo = (uintptr_t)p / LINESIZE;
+	hi = ((uintptr_t)p + size - 1) / LINESIZE;
+	if (hi - lo + 1 > (size + LINESIZE - 1) / LINESIZE)
+	    stats->chase_straddle++;
+	for (k = lo; k <= hi; k++) {
+	    lines[nlines] = k;
+	    pages[nlines++] = k * LINESIZE / PAGESIZE;
+	}
+    }
+    stats->chase_blocks = nblocks;
+    if (nblocks == 0) {
+	free(lines);
+	free(pages);
+	free(sizes);
+	return;
+    }
+    *(char **)prev = chase.head;
+
+    /* Count the distinct lines and pages */
+    qsort(lines, nlines, sizeof(long), ulong_cmp);
+    qsort(pages, nlines, sizeof(long), ulong_cmp);
+    stats->chase_lines = stats->chase_pages = 0;
+    for (k = 0; k < nlines; k++) {
+	stats->chase_lines += (k == 0 || lines[k] != lines[k - 1]);
+	stats->chase_pages += (k == 0 || pages[k] != pages[k - 1]);
+    }
+
+    /* Time the walk, and count its LLC misses */
+    chase.hops = nblocks * ((CHASE_HOPS + nblocks - 1) / nblocks);
+    stats->chase_secs = fsecs(eval_mm_chase_walk, &chase) / chase.hops;
+    stats->chase_llc = -1;
+    if (events) {
+	fcyc_perfctr(eval_mm_chase_walk, &chase, counts);
+	if (counts[PERFCTR_LLC] >= 0)
+	    stats->chase_llc = counts[PERFCTR_LLC] / chase.hops;
+    }
+    free(lines);
+    free(pages);
+    free(sizes);
+}
+
+/*
+ * eval_mm_chase_walk - Follow the ring of eval_mm_chase for chase->hops
+ *    hops, loading the last word of each block on the way.  Timed by fcyc.
+ */
+static void eval_mm_chase_walk(void *ptr)
+{
+    chase_t *chase = (chase_t *)ptr;
+    uintptr_t sum = 0;
+    unsigned long i;
+    char *p = chase->head;
+
+    for (i = 0; i < chase->hops; i++) {
+	sum += *(uintptr_t *)(p + ((uintptr_t *)p)[1]);
+	p = *(char **)p;
+    }
+    chase->sum = sum;
+}
+
+/*
+ * ulong_cmp - Compare two unsigned longs for qsort
+ */
+static int ulong_cmp(const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * eval_mm_threads - Replay the trace from each of thread_counts[] threads
+ *    at once, every thread with its own blocks, and record the best
+ *    aggregate throughput of PAR_RUNS runs at each thread count.  If pipe
+ *    is set, the threads are paired up instead: each producer replays the
+ *    trace's allocations and reallocations and hands every free to its
+ *    consumer, which makes the mm_free call on another thread.
+ */
+static void eval_mm_threads(trace_t *trace, stats_t *stats, int pipe)
+{
+    int i, j, k, n, failed;
+    double start, end, best;
+    pthread_t tids[MAXTHREADS];
+    thread_t args[MAXTHREADS];
+    ring_t *rings;
+    pthread_barrier_t barrier;
+
+    if ((rings = calloc(MAXTHREADS / 2, sizeof(ring_t))) == NULL)
+	unix_error("calloc failed in eval_mm_threads");
+    for (j = 0; j < MAXTHREADS; j++) {
+	args[j].trace = trace;
+	args[j].barrier = &barrier;
+	args[j].ring = pipe ? &rings[j / 2] : NULL;
+	if ((args[j].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL)
+	    unix_error("calloc failed in eval_mm_threads");
+    }
+
+    for (i = 0; i < NTHREADCOUNTS; i++) {
+	n = thread_counts[i];
+	best = DBL_MAX;
+	failed = pipe && n < 2;
+	for (k = 0; k < PAR_RUNS && !failed; k++) {
+	    /* Reset the heap and initialize the mm package */
+	    mem_reset_brk();
+	    if (mm_init() < 0)
+		app_error("mm_init failed in eval_mm_threads");
+
+	    /* 
+	     * The threads start together once all are created, and the run
+	     * lasts from the first one's start to the last one's end.
+	     */
+	    pthread_barrier_init(&barrier, NULL, n);
+	    memset(rings, 0, MAXTHREADS / 2 * sizeof(ring_t));
+	    for (j = 0; j < n; j++) {
+		args[j].failed = 0;
+		if (pthread_create(&tids[j], NULL, (pipe && j % 2) ? 
+				   consumer_thread : replay_thread, &args[j]))
+		    app_error("pthread_create failed in eval_mm_threads");
+	    }
+	    start = DBL_MAX;
+	    end = 0;
+	    for (j = 0; j < n; j++) {
+		pthread_join(tids[j], NULL);
+		failed |= args[j].failed;
+		start = start < args[j].start ? start : args[j].start;
+		end = end > args[j].end ? end : args[j].end;
+	    }
+	    pthread_barrier_destroy(&barrier);
+	    if ((end - start) / 1E9 < best)
+		best = (end - start) / 1E9;
+	}
+	if (pipe)
+	    stats->pc_kops[i] = failed ? 0 : 
+		(n / 2 * trace->num_ops / 1e3) / best;
+	else
+	    stats->par_kops[i] = failed ? 0 : 
+		(n * trace->num_ops / 1e3) / best;
+    }
+
+    for (j = 0; j < MAXTHREADS; j++)
+	free(args[j].blocks);
+    free(rings);
+}
+
+/*
+ * replay_thread - Body of one thread of eval_mm_threads.  Stops early,
+ *    setting failed, if the allocator runs out of memory.  A producer
+ *    queues its frees on its ring, waiting while the ring is full.
+ */
+static void *replay_thread(void *arg)
+{
+    thread_t *t = (thread_t *)arg;
+    trace_t *trace = t->trace;
+    unsigned i, index;
+    char *p;
+
+    pthread_barrier_wait(t->barrier);
+    t->start = get_nsecs();
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops && !t->failed;  i++) {
+	index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+		t->failed = 1;
+            t->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(t->blocks[index], 
+				trace->ops[i].size)) == NULL)
+		t->failed = 1;
+            t->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free, or hand it to the consumer */
+	    if (t->ring == NULL) {
+		mm_free(t->blocks[index]);
+		break;
+	    }
+	    while (t->ring->tail - 
+		   __atomic_load_n(&t->ring->head, __ATOMIC_ACQUIRE) == RINGSIZE)
+		sched_yield();
+	    t->ring->slots[t->ring->tail % RINGSIZE] = t->blocks[index];
+	    __atomic_store_n(&t->ring->tail, t->ring->tail + 1, 
+			     __ATOMIC_RELEASE);
+            break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+        }
+    }
+    t->end = get_nsecs();
+    if (t->ring != NULL)
+	__atomic_store_n(&t->ring->done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * consumer_thread - Body of a consumer thread of eval_mm_threads.  Frees
+ *    the blocks its producer queues until the producer is done.
+ */
+static void *consumer_thread(void *arg)
+{
+    thread_t *t = (thread_t *)arg;
+    ring_t *ring = t->ring;
+    unsigned tail;
+    int done;
+
+    pthread_barrier_wait(t->barrier);
+    t->start = get_nsecs();
+
+    for (;;) {
+	/* Read done first, so that no free queued before it is missed */
+	done = __atomic_load_n(&ring->done, __ATOMIC_ACQUIRE);
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	if (ring->head == tail) {
+	    if (done)
+		break;
+	    sched_yield();
+	    continue;
+	}
+	while (ring->head != tail) {
+	    mm_free(ring->slots[ring->head % RINGSIZE]);
+	    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+	}
+    }
+    t->end = get_nsecs();
+    return NULL;
+}
+
+/*
+ * eval_mm_numa - For each NUMA node, replay the trace up to its peak of
+ *    live blocks from a thread on that node, so that the blocks come from
+ *    the node's arena, and then time passes over the blocks from a thread
+ *    on each node.  Passes from the blocks' own node count as local, the
+ *    others as remote.  Nodes without CPUs are left out.
+ */
+static void eval_mm_numa(trace_t *trace, stats_t *stats)
+{
+    int a, b, nlocal = 0, nremote = 0;
+    double local = 0, remote = 0;
+    pthread_t tid;
+    numa_t numa;
+
+    numa.trace = trace;
+    if ((numa.sizes = calloc(trace->num_ids, sizeof(unsigned))) == NULL)
+	unix_error("calloc failed in eval_mm_numa");
+    for (a = 0; a < mem_arenas(); a++) {
+	if (node_cpus(mem_arena_node(a), &numa.cpus) == 0)
+	    continue;
+	if (pthread_create(&tid, NULL, numa_alloc_thread, &numa))
+	    app_error("pthread_create failed in eval_mm_numa");
+	pthread_join(tid, NULL);
+
+	for (b = 0; b < mem_arenas(); b++) {
+	    if (node_cpus(mem_arena_node(b), &numa.cpus) == 0)
+		continue;
+	    if (pthread_create(&tid, NULL, numa_access_thread, &numa))
+		app_error("pthread_create failed in eval_mm_numa");
+	    pthread_join(tid, NULL);
+	    if (numa.secs <= 0)
+		continue;
+	    if (a == b) {
+		local += numa.bytes / numa.secs / 1e6;
+		nlocal++;
+	    } else {
+		remote += numa.bytes / numa.secs / 1e6;
+		nremote++;
+	    }
+	}
+    }
+    stats->numa_local = nlocal ? local / nlocal : 0;
+    stats->numa_remote = nremote ? remote / nremote : 0;
+    free(numa.sizes);
+}
+
+/*
+ * node_cpus - Set cpus to the CPUs of a NUMA node that this process may
+ *    run on, and return how many there are
+ */
+static int node_cpus(int node, cpu_set_t *cpus)
+{
+    cpu_set_t allowed;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+	unix_error("sched_getaffinity failed in node_cpus");
+    CPU_ZERO(cpus);
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	if (CPU_ISSET(cpu, &allowed) && mem_cpu_node(cpu) == node)
+	    CPU_SET(cpu, cpus);
+    return CPU_COUNT(cpus);
+}
+
+/*
+ * numa_alloc_thread - Body of the thread of eval_mm_numa that allocates
+ *    the blocks.  A new thread takes the arena of its node as its home.
+ */
+static void *numa_alloc_thread(void *arg)
+{
+    numa_t *numa = (numa_t *)arg;
+
+    if (sched_setaffinity(0, sizeof(numa->cpus), &numa->cpus) < 0)
+	unix_error("sched_setaffinity failed in numa_alloc_thread");
+    replay_peak(numa->trace, numa->sizes, "eval_mm_numa");
+    return NULL;
+}
+
+/*
+ * numa_access_thread - Body of a thread of eval_mm_numa that times passes
+ *    adding one to every word of the live blocks, for at least NUMA_BYTES
+ *    bytes in all
+ */
+static void *numa_access_thread(void *arg)
+{
+    numa_t *numa = (numa_t *)arg;
+    trace_t *trace = numa->trace;
+    unsigned index, n = 0, k, w, pass, passes;
+    unsigned *words;
+    uintptr_t **blocks, *p;
+    double bytes = 0, start;
+
+    if (sched_setaffinity(0, sizeof(numa->cpus), &numa->cpus) < 0)
+	unix_error("sched_setaffinity failed in numa_access_thread");
+
+    /* List the live blocks, so that the passes skip the dead ids */
+    if ((blocks = malloc(trace->num_ids * sizeof(uintptr_t *))) == NULL ||
+	(words = malloc(trace->num_ids * sizeof(unsigned))) == NULL)
+	unix_error("malloc failed in numa_access_thread");
+    for (index = 0; index < trace->num_ids; index++) {
+	if (numa->sizes[index] < sizeof(uintptr_t))
+	    continue;
+	blocks[n] = (uintptr_t *)trace->blocks[index];
+	words[n] = numa->sizes[index] / sizeof(uintptr_t);
+	bytes += words[n++] * sizeof(uintptr_t);
+    }
+    passes = bytes > 0 ? (unsigned)ceil(NUMA_BYTES / bytes) : 0;
+
+    start = get_nsecs();
+    for (pass = 0; pass < passes; pass++) {
+	for (k = 0; k < n; k++) {
+	    p = blocks[k];
+	    for (w = 0; w < words[k]; w++)
+		p[w]++;
+	}
+    }
+    numa->secs = (get_nsecs() - start) / 1e9;
+    numa->bytes = bytes * passes;
+    free(blocks);
+    free(words);
+    return NULL;
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, stats_t *stats) 
+{
+    int i;
+    double secs = 0;
+    double ops = 0;
+    double util = 0;
+
+    /* Print the individual results for each trace */
+    /* All the space before the last number on each line is added by 
+     * Zheng Cai, for better formatting */
+    printf("%5s%7s %5s%8s%10s %6s\n", 
+	   "trace", " valid", "util", "ops", "secs", "Kops");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid) {
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f %6.0f\n", 
+		   i,
+		   "yes",
+		   stats[i].util*100.0,
+		   stats[i].ops,
+		   stats[i].secs,
+		   (stats[i].ops/1e3)/stats[i].secs);
+	    secs += stats[i].secs;
+	    ops += stats[i].ops;
+	    util += stats[i].util;
+	}
+	else {
+	    printf("%2d%10s%6s%8s%10s %6s\n", 
+		   i,
+		   "no",
+		   "-",
+		   "-",
+		   "-",
+		   "-");
+	}
+    }
+
+    /* Print the aggregate results for the set of traces */
+    if (errors == 0) {
+	printf("%12s%5.0f%%%8.0f%10.6f %6.0f\n", 
+	       "Total       ",
+	       (util/n)*100.0,
+	       ops, 
+	       secs,
+	       (ops/1e3)/secs);
+    }
+    else {
+	printf("%12s%6s%8s%10s %6s\n", 
+	       "Total       ",
+	       "-", 
+	       "-", 
+	       "-", 
+	       "-");
+    }
+
+}
+
+/*
+ * printlatency - prints the latency quantiles of each type of request in
+ *    each trace
+ */
+static void printlatency(int n, stats_t *stats) 
+{
+    static const char *names[NOPTYPES] = {"malloc", "free", "realloc"};
+    int i, t;
+
+    printf("%5s%8s%8s%9s%9s%9s%9s\n", 
+	   "trace", "op", "ops", "p50", "p99", "p99.9", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%11s%8s%9s%9s%9s%9s\n", i, "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	for (t = 0; t < NOPTYPES; t++) {
+	    if (stats[i].lat_ops[t] == 0)
+		continue;
+	    printf("%2d%11s%8lu%9.0f%9.0f%9.0f%9.0f\n", 
+		   i,
+		   names[t],
+		   stats[i].lat_ops[t],
+		   stats[i].lat[t][0],
+		   stats[i].lat[t][1],
+		   stats[i].lat[t][2],
+		   stats[i].lat[t][3]);
+	}
+    }
+}
+
+/*
+ * printthreads - prints the threaded throughput of each trace, with "-"
+ *    where the heap could not hold that many copies of the trace.  If pipe
+ *    is set, prints the producer/consumer throughput instead.
+ */
+static void printthreads(int n, stats_t *stats, int pipe) 
+{
+    double kops;
+    int i, j;
+
+    printf("%5s", "trace");
+    for (j = 0; j < NTHREADCOUNTS; j++)
+	printf("%7d th", thread_counts[j]);
+    printf("\n");
+    for (i=0; i < n; i++) {
+	printf("%2d   ", i);
+	for (j = 0; j < NTHREADCOUNTS; j++) {
+	    kops = pipe ? stats[i].pc_kops[j] : stats[i].par_kops[j];
+	    if (stats[i].valid && kops > 0)
+		printf("%9.0f", kops);
+	    else
+		printf("%9s", "-");
+	}
+	printf("\n");
+    }
+}
+
+/*
+ * printbatch - prints the batched replay of each trace: the allocator
+ *    calls it took, the requests per call, and its throughput against the
+ *    request-by-request replay
+ */
+static void printbatch(int n, stats_t *stats) 
+{
+    int i;
+
+    printf("%5s%8s%9s%10s %6s%9s\n", 
+	   "trace", "calls", "ops/call", "secs", "Kops", "speedup");
+    for (i=0; i < n; i++) {
+	if (stats[i].valid && stats[i].batch_valid) {
+	    printf("%2d%11.0f%9.1f%10.6f %6.0f%8.2fx\n", 
+		   i,
+		   stats[i].batch_calls,
+		   stats[i].ops / stats[i].batch_calls,
+		   stats[i].batch_secs,
+		   (stats[i].ops/1e3)/stats[i].batch_secs,
+		   stats[i].secs / stats[i].batch_secs);
+	}
+	else {
+	    printf("%2d%11s%9s%10s %6s%9s\n", i, "-", "-", "-", "-", "-");
+	}
+    }
+}
+
+/*
+ * printchase - prints the pointer chase of each trace: the blocks on the
+ *    ring, the cache lines their payloads touch per block, the percentage
+ *    of blocks that straddle a line more than their size needs, the pages
+ *    touched, and the nsecs and LLC misses per hop
+ */
+static void printchase(int n, stats_t *stats) 
+{
+    int i;
+
+    printf("%5s%9s%10s%9s%8s%8s%9s\n", 
+	   "trace", "blocks", "lines/blk", "straddle", "pages", "ns/hop",
+	   "LLC/hop");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid || stats[i].chase_blocks == 0) {
+	    printf("%2d%12s%10s%9s%8s%8s%9s\n", 
+		   i, "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	printf("%2d%12.0f%10.2f%8.1f%%%8.0f%8.2f", 
+	       i,
+	       stats[i].chase_blocks,
+	       stats[i].chase_lines / stats[i].chase_blocks,
+	       100.0 * stats[i].chase_straddle / stats[i].chase_blocks,
+	       stats[i].chase_pages,
+	       stats[i].chase_secs * 1e9);
+	if (stats[i].chase_llc < 0)
+	    printf("%9s\n", "-");
+	else
+	    printf("%9.3f\n", stats[i].chase_llc);
+    }
+}
+
+/*
+ * printnuma - prints the access throughput over each trace's blocks from
+ *    their own NUMA node and from the others, and the ratio of the two
+ */
+static void printnuma(int n, stats_t *stats) 
+{
+    int i;
+
+    printf("%5s%10s%10s%8s\n", "trace", "local", "remote", "ratio");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid || stats[i].numa_local <= 0)
+	    printf("%2d%13s%10s%8s\n", i, "-", "-", "-");
+	else if (stats[i].numa_remote <= 0)
+	    printf("%2d%13.0f%10s%8s\n", i, stats[i].numa_local, "-", "-");
+	else
+	    printf("%2d%13.0f%10.0f%7.2fx\n", i, stats[i].numa_local,
+		   stats[i].numa_remote, 
+		   stats[i].numa_local / stats[i].numa_remote);
+    }
+}
+
+/*
+ * printhuge - prints how much of the heap was resident after each trace's
+ *    utilization replay and how much of that the OS backed with huge
+ *    pages, which shows whether -T took effect at all
+ */
+static void printhuge(int n, stats_t *stats) 
+{
+    double huge = 0;
+    int i;
+
+    printf("%5s%10s%10s%8s\n", "trace", "rssKB", "hugeKB", "huge");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid || stats[i].thp_resident <= 0) {
+	    printf("%2d%13s%10s%8s\n", i, "-", "-", "-");
+	    continue;
+	}
+	huge += stats[i].thp_huge;
+	printf("%2d%13.0f%10.0f%7.0f%%\n", i, stats[i].thp_resident,
+	       stats[i].thp_huge, 
+	       100.0 * stats[i].thp_huge / stats[i].thp_resident);
+    }
+    if (huge == 0)
+	printf("No huge pages: see "
+	       "/sys/kernel/mm/transparent_hugepage/enabled\n");
+}
+
+/*
+ * printcounters - prints the allocator's counters for each trace, and the
+ *    per-class counters summed over all the traces
+ */
+static void printcounters(int n, stats_t *stats) 
+{
+    struct mm_stats *c, total;
+    size_t allocs, frees, searches, walks, splits, coalesces;
+    int i, k;
+
+    memset(&total, 0, sizeof(total));
+    printf("%5s%8s%8s%8s%7s%8s%8s%8s%8s%8s\n", "trace", "allocs", "frees",
+	   "fits", "walk", "splits", "merges", "extends", "extKB", "peakKB");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%11s%8s%8s%7s%8s%8s%8s%8s%8s\n", 
+		   i, "-", "-", "-", "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	c = &stats[i].counters;
+	allocs = frees = searches = walks = splits = coalesces = 0;
+	for (k = 0; k < MM_NCLASSES; k++) {
+	    allocs += c->allocs[k];
+	    frees += c->frees[k];
+	    searches += c->fit_searches[k];
+	    walks += c->fit_walks[k];
+	    splits += c->splits[k];
+	    coalesces += c->coalesces[k];
+	    total.allocs[k] += c->allocs[k];
+	    total.frees[k] += c->frees[k];
+	    total.fit_searches[k] += c->fit_searches[k];
+	    total.fit_walks[k] += c->fit_walks[k];
+	    total.splits[k] += c->splits[k];
+	    total.coalesces[k] += c->coalesces[k];
+	}
+	printf("%2d%11zu%8zu%8zu%7.2f%8zu%8zu%8zu%8zu%8zu\n", 
+	       i, allocs, frees, searches,
+	       searches ? (double)walks / searches : 0.0,
+	       splits, coalesces, c->extend_calls,
+	       c->extend_bytes / 1024, c->peak_heap / 1024);
+    }
+
+    printf("\n%5s%8s%8s%8s%7s%8s%8s\n", "class", "allocs", "frees",
+	   "fits", "walk", "splits", "merges");
+    for (k = 0; k < MM_NCLASSES; k++) {
+	printf("%2d%11zu%8zu%8zu%7.2f%8zu%8zu\n", 
+	       k, total.allocs[k], total.frees[k], total.fit_searches[k],
+	       total.fit_searches[k] ? 
+	       (double)total.fit_walks[k] / total.fit_searches[k] : 0.0,
+	       total.splits[k], total.coalesces[k]);
+    }
+}
+
+/*
+ * printtrials - Print the mean Kops/sec of each trace's timing trials,
+ *     with its 95% confidence interval and the slowest and fastest trial
+ */
+static void printtrials(int n, stats_t *stats)
+{
+    double kops, lo, hi;
+    int i, t;
+
+    printf("%5s%8s%10s%9s%10s%10s\n", 
+	   "trace", "trials", "mean", "+/-95%", "min", "max");
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%11s%10s%9s%10s%10s\n", i, "-", "-", "-", "-", "-");
+	    continue;
+	}
+	lo = DBL_MAX;
+	hi = 0;
+	for (t = 0; t < stats[i].trials; t++) {
+	    kops = stats[i].ops / 1e3 / stats[i].trial_secs[t];
+	    lo = kops < lo ? kops : lo;
+	    hi = kops > hi ? kops : hi;
+	}
+	printf("%2d%11d%10.0f%9.0f%10.0f%10.0f\n", i, stats[i].trials,
+	       stats[i].ops / 1e3 / stats[i].secs, trial_ci(&stats[i]), lo, hi);
+    }
+}
+
+/*
+ * printperfctr - Print the hardware events of each trace's replay per
+ *     request, and for all the traces together
+ */
+static void printperfctr(int n, stats_t *stats)
+{
+    double total[NPERFCTRS], ops = 0;
+    int counted[NPERFCTRS];
+    int i, c;
+
+    printf("%5s", "trace");
+    for (c = 0; c < NPERFCTRS; c++)
+	printf("%9s", perfctr_names[c]);
+    printf("\n");
+    for (c = 0; c < NPERFCTRS; c++) {
+	total[c] = 0;
+	counted[c] = 1;
+    }
+    for (i=0; i < n; i++) {
+	printf("%2d   ", i);
+	if (stats[i].valid)
+	    ops += stats[i].ops;
+	for (c = 0; c < NPERFCTRS; c++) {
+	    if (!stats[i].valid || stats[i].events[c] < 0) {
+		/* A valid trace whose event was not counted spoils the total */
+		if (stats[i].valid)
+		    counted[c] = 0;
+		printf("%9s", "-");
+		continue;
+	    }
+	    total[c] += stats[i].events[c];
+	    printf("%9.2f", stats[i].events[c] / stats[i].ops);
+	}
+	printf("\n");
+    }
+    printf("%-5s", "Total");
+    for (c = 0; c < NPERFCTRS; c++) {
+	if (ops == 0 || !counted[c])
+	    printf("%9s", "-");
+	else
+	    printf("%9.2f", total[c] / ops);
+    }
+    printf("\n");
+}
+
+/*
+ * trial_ci - Return the half-width of the 95% confidence interval of the
+ *     mean Kops/sec of a trace's timing trials, from Student's t
+ *     distribution, or 0 for a single trial
+ */
+static double trial_ci(stats_t *stats)
+{
+    /* Two-sided 95% quantiles of t for 1 to 30 degrees of freedom */
+    static const double t95[30] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    double kops, mean = 0, var = 0;
+    int n = stats->trials, t;
+
+    if (n < 2)
+	return 0;
+    for (t = 0; t < n; t++)
+	mean += stats->ops / 1e3 / stats->trial_secs[t] / n;
+    for (t = 0; t < n; t++) {
+	kops = stats->ops / 1e3 / stats->trial_secs[t];
+	var += (kops - mean) * (kops - mean) / (n - 1);
+    }
+    return (t95[n - 2 < 30 ? n - 2 : 29] * sqrt(var / n));
+}
+
+/*
+ * writejson - Write the per-trace results and the totals to file as a
+ *     JSON object, for scripts that compare runs
+ */
+static void writejson(char *file, char **tracefiles, int n, stats_t *stats,
+		      int events, double util, double throughput, 
+		      double perfindex)
+{
+    FILE *fp;
+    int i, t, c, numcorrect = 0;
+
+    if ((fp = fopen(file, "w")) == NULL)
+	unix_error("fopen failed in writejson");
+    fprintf(fp, "{\n  \"traces\": [\n");
+    for (i=0; i < n; i++) {
+	fprintf(fp, "    {\"trace\": ");
+	putjson(fp, tracefiles[i]);
+	fprintf(fp, ", \"valid\": %s, \"ops\": %.0f", 
+		stats[i].valid ? "true" : "false", stats[i].ops);
+	if (stats[i].valid) {
+	    numcorrect++;
+	    fprintf(fp, ", \"util\": %.4f, \"secs\": %.6f, \"kops\": %.1f, "
+		    "\"kops_ci95\": %.1f, \"trials_kops\": [",
+		    stats[i].util, stats[i].secs, 
+		    stats[i].ops / 1e3 / stats[i].secs, trial_ci(&stats[i]));
+	    for (t = 0; t < stats[i].trials; t++)
+		fprintf(fp, "%s%.1f", t ? ", " : "", 
+			stats[i].ops / 1e3 / stats[i].trial_secs[t]);
+	    fprintf(fp, "]");
+	    if (events) {
+		fprintf(fp, ", \"events\": {");
+		for (c = 0; c < NPERFCTRS; c++) {
+		    fprintf(fp, "%s\"%s\": ", c ? ", " : "", perfctr_names[c]);
+		    if (stats[i].events[c] < 0)
+			fprintf(fp, "null");
+		    else
+			fprintf(fp, "%.0f", stats[i].events[c]);
+		}
+		fprintf(fp, "}");
+	    }
+	}
+	fprintf(fp, "}%s\n", i < n - 1 ? "," : "");
+    }
+    fprintf(fp, "  ],\n  \"correct\": %d, \"errors\": %d, "
+	    "\"util\": %.4f, \"kops\": %.1f, \"perfindex\": %.1f\n}\n",
+	    numcorrect, errors, util, throughput / 1e3, perfindex);
+    if (fclose(fp) != 0)
+	unix_error("fclose failed in writejson");
+}
+
+/*
+ * putjson - Write s to fp as a JSON string, quoted, with quotes,
+ *     backslashes and control characters escaped
+ */
+static void putjson(FILE *fp, const char *s)
+{
+    const unsigned char *p;
+
+    fputc('"', fp);
+    for (p = (const unsigned char *)s; *p != '\0'; p++) {
+	if (*p == '"' || *p == '\\')
+	    fprintf(fp, "\\%c", *p);
+	else if (*p < 0x20)
+	    fprintf(fp, "\\u%04x", *p);
+	else
+	    fputc(*p, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+ * parse_size - Return the byte size in s, a number with an optional K, M
+ *     or G suffix, or 0 if s is not a size
+ */
+static size_t parse_size(char *s)
+{
+    char *end;
+    size_t size = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g':
+	size <<= 10;
+	/* fall through */
+    case 'M': case 'm':
+	size <<= 10;
+	/* fall through */
+    case 'K': case 'k':
+	size <<= 10;
+	end++;
+    }
+    return (end == s || *end != '\0') ? 0 : size;
+}
+
+/*
+ * get_nsecs - Return the current time of the monotonic clock in nsecs
+ */
+static double get_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1E9 + ts.tv_nsec);
+}
+
+/*
+ * hist_add - Record a latency of "cycles" cycles in a histogram.  Values
+ *    below 2^HIST_SUBBITS get a bucket each, and every larger power of
+ *    two is split into 2^HIST_SUBBITS buckets.
+ */
+static void hist_add(hist_t *hist, double cycles)
+{
+    unsigned long long v = (unsigned long long)cycles;
+    int b = 0, e;
+
+    if (v >= (1ULL << HIST_SUBBITS)) {
+	e = 63 - __builtin_clzll(v) - HIST_SUBBITS;
+	b = ((e + 1) << HIST_SUBBITS) + (int)((v >> e) - (1ULL << HIST_SUBBITS));
+    } else
+	b = (int)v;
+    hist->counts[b]++;
+    hist->total++;
+    if (cycles > hist->max)
+	hist->max = cycles;
+}
+
+/*
+ * hist_quantile - Return the "q" quantile of a histogram, as the highest
+ *    value of the bucket that holds it.  The 1.0 quantile is the exact
+ *    maximum.
+ */
+static double hist_quantile(hist_t *hist, double q)
+{
+    unsigned long rank, seen = 0;
+    int b, e;
+
+    if (hist->total == 0)
+	return 0;
+    if (q >= 1.0)
+	return hist->max;
+    rank = (unsigned long)(q * (hist->total - 1)) + 1;
+    for (b = 0; b < HIST_NBUCKETS; b++) {
+	if ((seen += hist->counts[b]) >= rank)
+	    break;
+    }
+    if (b < (1 << HIST_SUBBITS))
+	return b;
+    e = (b >> HIST_SUBBITS) - 1;
+    return (double)(((unsigned long long)(b & ((1 << HIST_SUBBITS) - 1)) +
+		     (1ULL << HIST_SUBBITS) + 1) << e) - 1;
 }
 
 /* 
@@ -884,13 +2779,29 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-aghvV] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-aBCeghlNPSTvVw] [-c <n>] [-f <file>] [-H <size>]\n"
+	    "               [-j <n>] [-J <file>] [-n <n>] [-s <n>] [-t <dir>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B         Print batched malloc/free replay throughput.\n");
+    fprintf(stderr, "\t-c <n>     Check <n> heap blocks with mm_check after every request.\n");
+    fprintf(stderr, "\t-C         Print producer/consumer throughput (MM_THREADS only).\n");
+    fprintf(stderr, "\t-e         Print hardware events per request with perf_event.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <size>  Simulate a heap of <size> bytes (K, M or G).\n");
+    fprintf(stderr, "\t-j <n>     Run each trace in a CPU-pinned worker, <n> at a time.\n");
+    fprintf(stderr, "\t-J <file>  Write the results to <file> as JSON.\n");
+    fprintf(stderr, "\t-l         Print per-request latency quantiles in cycles.\n");
+    fprintf(stderr, "\t-n <n>     Time each trace <n> times, with a 95%% confidence interval.\n");
+    fprintf(stderr, "\t-N         Print NUMA local/remote access throughput (MM_THREADS only).\n");
+    fprintf(stderr, "\t-P         Print threaded throughput (MM_THREADS only).\n");
+    fprintf(stderr, "\t-s <n>     Snapshot the heap every <n> requests to <trace>.snap.\n");
+    fprintf(stderr, "\t-S         Print allocator counters (MM_STATS only).\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
+    fprintf(stderr, "\t-T         Back the heap with 2MB transparent huge pages.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w         Time a pointer chase over the small live blocks.\n");
 }
@@ -2,7 +2,34 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ *            Besides the heaps, memory can be mapped directly from the OS
+ *            with mem_map.  Mapped bytes count towards the heap size, and
+ *            the mappings count towards the extent of the heap.  The
+ *            mapping routines may be called from several threads at once.
+ *
+ *            The simulated memory is reserved with mmap, so that pages
+ *            given back with mem_release or a negative mem_sbrk stop
+ *            counting towards the resident size of the process.
+ *
+ *            The simulated memory can be split into several arenas, each
+ *            an independent heap with its own brk pointer.  The arenas are
+ *            laid out one after the other in a single block of storage, so
+ *            the arena holding an address is found with a division.
+ *
+ *            On a NUMA machine, the arenas are spread over the nodes that
+ *            have memory, arena i on the (i mod nodes)-th of them, and the
+ *            storage of each is bound to its node with mbind, so that its
+ *            pages come from that node whichever thread touches them
+ *            first.
+ *
+ *            With mem_hugepages set, each arena is a multiple of
+ *            MEM_HUGEPAGE bytes starting on a multiple of it, and asks for
+ *            transparent huge pages with madvise.  Memory is then given
+ *            back to the OS only in whole huge pages, so that a release
+ *            never splits one.
  */
+#define _GNU_SOURCE  /* for mremap and MAP_NORESERVE */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -10,28 +37,102 @@
 #include <sys/mman.h>
 #include <string.h>
 #include <errno.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 
 #include "memlib.h"
 #include "config.h"
 
+/* largest heap mem_init sets up, which mdriver -H can change */
+size_t max_heap = DEFAULT_MAX_HEAP;
+
+/* back the arenas with transparent huge pages, which mdriver -T sets */
+int mem_hugepages = 0;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_start_brk;  /* points to first byte of the first arena */
+static size_t mem_arena_max; /* largest legal size of each arena */
+static int mem_narenas;      /* number of arenas */
+static char *mem_brks[MEM_MAXARENAS]; /* points to last byte of each arena */
+static char *mem_fresh[MEM_MAXARENAS]; /* each arena reads as zero from here */
+static size_t mem_mapped;    /* bytes currently mapped with mem_map */
+static char *mem_map_lo;     /* lowest byte ever mapped, or NULL */
+static char *mem_map_hi;     /* highest byte ever mapped, or NULL */
+static int mem_nnodes;       /* NUMA nodes with memory, 0 until read */
+static int mem_node_ids[MEM_MAXNODES]; /* their node numbers */
+static signed char mem_cpu_nodes[MEM_MAXCPUS]; /* node of each CPU, or -1 */
+
+static void mem_map_extent(char *p, size_t size);
+static size_t mem_dontneed(char *lo, char *hi);
+static size_t mem_unit(void);
+static void mem_init_nodes(void);
+static int mem_read_list(const char *path, int *ids, int max);
+static void mem_bind(int arena);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
-    /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
-	fprintf(stderr, "mem_init_vm: malloc error\n");
+    mem_init_arenas(1, MAX_HEAP);
+}
+
+/* 
+ * mem_init_size - initialize the memory system model with a heap of at
+ *    most size bytes instead of MAX_HEAP
+ */
+void mem_init_size(size_t size)
+{
+    mem_init_arenas(1, size);
+}
+
+/* 
+ * mem_init_arenas - initialize the memory system model with narenas
+ *    independent heaps of at most size bytes each
+ */
+void mem_init_arenas(int narenas, size_t size)
+{
+    size_t unit = mem_unit(), extra = mem_hugepages ? unit : 0;
+    char *p;
+    int i;
+
+    assert(narenas >= 1 && narenas <= MEM_MAXARENAS);
+
+    /* 
+     * Reserve the storage we will use to model the available VM.  With
+     * huge pages, reserve a huge page more, and trim the ends so that
+     * every arena starts on a huge page.
+     */
+    size = (size + unit - 1) & ~(unit - 1);
+    p = mmap(NULL, narenas * size + extra, PROT_READ | PROT_WRITE,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
 	exit(1);
     }
+    mem_start_brk = p;
+    if (mem_hugepages) {
+	mem_start_brk = (char *)(((uintptr_t)p + unit - 1) & ~(unit - 1));
+	if (mem_start_brk > p)
+	    munmap(p, (size_t)(mem_start_brk - p));
+	munmap(mem_start_brk + narenas * size, 
+	       (size_t)(p + extra - mem_start_brk));
+#ifdef MADV_HUGEPAGE
+	madvise(mem_start_brk, narenas * size, MADV_HUGEPAGE);
+#endif
+    }
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_arena_max = size;
+    mem_narenas = narenas;
+    mem_reset_brk();                          /* heaps are empty initially */
+    for (i = 0; i < narenas; i++)
+	mem_fresh[i] = mem_brks[i];           /* and so is the new mapping */
+
+    /* nothing is touched yet, so every page will come from its node */
+    if (mem_nodes() > 1)
+	for (i = 0; i < narenas; i++)
+	    mem_bind(i);
 }
 
 /* 
@@ -39,57 +140,380 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    munmap(mem_start_brk, mem_narenas * mem_arena_max);
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make empty heaps
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    int i;
+
+    for (i = 0; i < mem_narenas; i++)
+	mem_brks[i] = mem_start_brk + i * mem_arena_max;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    by incr bytes and returns the start address of the new area. A
+ *    negative incr shrinks the heap, and the whole pages past the new
+ *    brk are given back to the OS.
  */
 void *mem_sbrk(intptr_t incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_sbrk_arena(0, incr);
+}
+
+/* 
+ * mem_sbrk_arena - mem_sbrk for the heap of the given arena.  With more
+ *    than one arena, running out is not reported, since the caller can
+ *    still try the others.
+ */
+void *mem_sbrk_arena(int arena, intptr_t incr) 
+{
+    char *old_brk = mem_brks[arena];
+    char *max_addr = mem_start_brk + (arena + 1) * mem_arena_max;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    char *min_addr = mem_start_brk + arena * mem_arena_max;
+
+    if (incr < 0) {
+	if (old_brk + incr < min_addr) {
+	    errno = EINVAL;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Shrunk below the heap...\n");
+	    return (void *)-1;
+	}
+	mem_trim_arena(arena, (size_t)-incr);
+	return (void *)old_brk;
+    }
+    if ((old_brk + incr) > max_addr) {
 	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	if (mem_narenas == 1)
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+    /* mem_heapsize() may read the brk while another thread moves it */
+    __atomic_store_n(&mem_brks[arena], old_brk + incr, __ATOMIC_RELAXED);
+    if (old_brk + incr > mem_fresh[arena])
+	mem_fresh[arena] = old_brk + incr;
     return (void *)old_brk;
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_trim_arena - shrink the heap of the given arena by size bytes, no
+ *    more than it holds, like a negative mem_sbrk_arena.  Returns the
+ *    number of bytes given back to the OS, which are the whole pages past
+ *    the new brk, or the whole huge pages with mem_hugepages.
+ */
+size_t mem_trim_arena(int arena, size_t size)
+{
+    char *old_brk = mem_brks[arena];
+    char *new_brk = old_brk - size;
+
+    __atomic_store_n(&mem_brks[arena], new_brk, __ATOMIC_RELAXED);
+    if (mem_fresh[arena] == old_brk)
+	mem_fresh[arena] = (char *)(((uintptr_t)new_brk + 
+	    mem_unit() - 1) & ~(mem_unit() - 1));
+    return mem_dontneed(new_brk, old_brk);
+}
+
+/*
+ * mem_fresh_lo - return the address from which the memory of an arena is
+ *    known to read as zero, since no brk has reached past it since it was
+ *    mapped or given back to the OS.  Like mem_sbrk_arena, it must not be
+ *    called while the arena's brk moves.
+ */
+void *mem_fresh_lo(int arena)
+{
+    return (void *)mem_fresh[arena];
+}
+
+/*
+ * mem_release - give the whole pages within the size bytes at p back to
+ *    the OS, or the whole huge pages with mem_hugepages.  The bytes stay
+ *    part of the heap, and read as zero once touched again.  Returns the
+ *    number of bytes given back.
+ */
+size_t mem_release(void *p, size_t size)
+{
+    size_t mask = mem_unit() - 1;
+    char *lo = (char *)(((uintptr_t)p + mask) & ~mask);
+    char *hi = (char *)(((uintptr_t)p + size) & ~mask);
+
+    if (lo >= hi)
+	return 0;
+    return mem_dontneed(lo, hi);
+}
+
+/*
+ * mem_map - map size bytes, a multiple of the page size, directly from the
+ *    OS.  Returns the start of the mapping, or (void *)-1 on failure.
+ */
+void *mem_map(size_t size)
+{
+    char *p = mmap(NULL, size, PROT_READ | PROT_WRITE, 
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+	return (void *)-1;
+#ifdef MADV_HUGEPAGE
+    if (mem_hugepages && size >= MEM_HUGEPAGE)
+	madvise(p, size, MADV_HUGEPAGE);
+#endif
+    __atomic_fetch_add(&mem_mapped, size, __ATOMIC_RELAXED);
+    mem_map_extent(p, size);
+    return (void *)p;
+}
+
+/*
+ * mem_unmap - give a mapping of size bytes made by mem_map back to the OS
+ */
+void mem_unmap(void *p, size_t size)
+{
+    if (munmap(p, size) == 0)
+	__atomic_fetch_sub(&mem_mapped, size, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_remap - resize a mapping made by mem_map from oldsize to newsize
+ *    bytes, possibly moving it.  Uses mremap where there is one, so that
+ *    the pages move without being copied.  Returns the new start of the
+ *    mapping, or (void *)-1 if it is left unchanged.
+ */
+void *mem_remap(void *p, size_t oldsize, size_t newsize)
+{
+    char *newp;
+
+#ifdef MREMAP_MAYMOVE
+    newp = mremap(p, oldsize, newsize, MREMAP_MAYMOVE);
+    if (newp == MAP_FAILED)
+	return (void *)-1;
+    __atomic_fetch_add(&mem_mapped, newsize - oldsize, __ATOMIC_RELAXED);
+    mem_map_extent(newp, newsize);
+#else
+    if ((newp = mem_map(newsize)) == (void *)-1)
+	return (void *)-1;
+    memcpy(newp, p, oldsize < newsize ? oldsize : newsize);
+    mem_unmap(p, oldsize);
+#endif
+    return (void *)newp;
+}
+
+/*
+ * mem_map_extent - widen the extent of the mappings to cover size bytes
+ *    at p
+ */
+static void mem_map_extent(char *p, size_t size)
+{
+    char *lo = __atomic_load_n(&mem_map_lo, __ATOMIC_RELAXED);
+    char *hi = __atomic_load_n(&mem_map_hi, __ATOMIC_RELAXED);
+
+    while ((lo == NULL || p < lo) && !__atomic_compare_exchange_n(&mem_map_lo,
+	&lo, p, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+    while ((hi == NULL || p + size - 1 > hi) && 
+	!__atomic_compare_exchange_n(&mem_map_hi, &hi, p + size - 1, 1,
+	__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+/*
+ * mem_dontneed - give the pages from lo, rounded up to a page, to hi back
+ *    to the OS.  With mem_hugepages, lo and hi are rounded up to a huge
+ *    page, since the bytes past hi are never in use when hi is not on
+ *    one already, and madvise would split the huge page that holds hi.
+ *    Returns the number of bytes given back.
+ */
+static size_t mem_dontneed(char *lo, char *hi)
+{
+    size_t mask = mem_unit() - 1;
+
+    lo = (char *)(((uintptr_t)lo + mask) & ~mask);
+    if (mem_hugepages)
+	hi = (char *)(((uintptr_t)hi + mask) & ~mask);
+    if (lo >= hi)
+	return 0;
+    madvise(lo, (size_t)(hi - lo), MADV_DONTNEED);
+    return (size_t)(hi - lo);
+}
+
+/*
+ * mem_unit - return the size of the pages the arenas are backed by
+ */
+static size_t mem_unit(void)
+{
+    return mem_hugepages ? MEM_HUGEPAGE : mem_pagesize();
+}
+
+/*
+ * mem_init_nodes - read the NUMA nodes with memory and the CPUs of each
+ *    from sysfs.  A machine whose topology cannot be read counts as a
+ *    single node 0.
+ */
+static void mem_init_nodes(void)
+{
+    static int cpus[MEM_MAXCPUS];
+    char path[64];
+    int i, j, n, ncpus;
+
+    for (i = 0; i < MEM_MAXCPUS; i++)
+	mem_cpu_nodes[i] = -1;
+    n = mem_read_list("/sys/devices/system/node/has_memory", mem_node_ids,
+		      MEM_MAXNODES);
+    if (n <= 1) {
+	mem_node_ids[0] = n == 1 ? mem_node_ids[0] : 0;
+	mem_nnodes = 1;
+	return;
+    }
+    for (i = 0; i < n; i++) {
+	sprintf(path, "/sys/devices/system/node/node%d/cpulist", 
+		mem_node_ids[i]);
+	ncpus = mem_read_list(path, cpus, MEM_MAXCPUS);
+	for (j = 0; j < ncpus; j++)
+	    mem_cpu_nodes[cpus[j]] = mem_node_ids[i];
+    }
+    mem_nnodes = n;
+}
+
+/*
+ * mem_read_list - read a sysfs list like "0-3,8" into ids, keeping the
+ *    numbers below max, and return how many there were, or -1 if the
+ *    file cannot be read
+ */
+static int mem_read_list(const char *path, int *ids, int max)
+{
+    FILE *fp = fopen(path, "r");
+    int lo, hi, sep, n = 0;
+
+    if (fp == NULL)
+	return -1;
+    while (fscanf(fp, "%d", &lo) == 1) {
+	hi = lo;
+	if ((sep = fgetc(fp)) == '-') {
+	    if (fscanf(fp, "%d", &hi) != 1)
+		break;
+	    sep = fgetc(fp);
+	}
+	for (; lo <= hi && lo < max && n < max; lo++)
+	    ids[n++] = lo;
+	if (sep != ',')
+	    break;
+    }
+    fclose(fp);
+    return n;
+}
+
+/*
+ * mem_bind - bind the storage of an arena to its NUMA node.  Should the
+ *    kernel refuse, the pages fall back to the node of the first touch.
+ */
+static void mem_bind(int arena)
+{
+#ifdef SYS_mbind
+    unsigned long mask = 1UL << mem_arena_node(arena);
+
+    syscall(SYS_mbind, mem_arena_lo(arena), mem_arena_max, MPOL_BIND,
+	    &mask, (unsigned long)MEM_MAXNODES + 1, 0);
+#endif
+}
+
+/*
+ * mem_arenas - return the number of arenas
+ */
+int mem_arenas()
+{
+    return mem_narenas;
+}
+
+/*
+ * mem_arena_of - return the arena whose storage holds address p, or -1
+ */
+int mem_arena_of(const void *p)
+{
+    if ((const char *)p < mem_start_brk ||
+	(const char *)p >= mem_start_brk + mem_narenas * mem_arena_max)
+	return -1;
+    return (int)(((const char *)p - mem_start_brk) / mem_arena_max);
+}
+
+/*
+ * mem_arena_lo - return address of the first byte of an arena's heap
+ */
+void *mem_arena_lo(int arena)
+{
+    return (void *)(mem_start_brk + arena * mem_arena_max);
+}
+
+/*
+ * mem_nodes - return the number of NUMA nodes with memory, 1 if the
+ *    machine is not NUMA or its topology cannot be read
+ */
+int mem_nodes()
+{
+    if (mem_nnodes == 0)
+	mem_init_nodes();
+    return mem_nnodes;
+}
+
+/*
+ * mem_arena_node - return the node number of the NUMA node that an
+ *    arena's storage is bound to
+ */
+int mem_arena_node(int arena)
+{
+    return mem_node_ids[arena % mem_nodes()];
+}
+
+/*
+ * mem_cpu_node - return the node number of the NUMA node of a CPU, or -1
+ *    if it is not known
+ */
+int mem_cpu_node(int cpu)
+{
+    if (mem_nodes() == 1)
+	return mem_node_ids[0];
+    return (cpu >= 0 && cpu < MEM_MAXCPUS) ? mem_cpu_nodes[cpu] : -1;
+}
+
+/*
+ * mem_heap_lo - return address of the first heap or mapped byte
  */
 void *mem_heap_lo()
 {
+    char *lo = __atomic_load_n(&mem_map_lo, __ATOMIC_RELAXED);
+
+    if (lo != NULL && lo < mem_start_brk)
+	return (void *)lo;
     return (void *)mem_start_brk;
 }
 
 /* 
- * mem_heap_hi - return address of last heap byte
+ * mem_heap_hi - return address of last heap byte, in the last arena, or
+ *    of the last mapped byte if that is higher
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    char *hi = mem_brks[mem_narenas - 1] - 1;
+    char *map_hi = __atomic_load_n(&mem_map_hi, __ATOMIC_RELAXED);
+
+    if (map_hi != NULL && map_hi > hi)
+	return (void *)map_hi;
+    return (void *)hi;
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the heap size in bytes, summed over the arenas,
+ *    plus the bytes currently mapped
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    size_t size = __atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+    int i;
+
+    for (i = 0; i < mem_narenas; i++)
+	size += (size_t)(__atomic_load_n(&mem_brks[i], __ATOMIC_RELAXED) -
+	    (char *)mem_arena_lo(i));
+    return size;
 }
 
 /*
@@ -99,3 +523,34 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_hugepage_usage - set *resident_kb to the kilobytes of the arenas
+ *    that are resident, and *huge_kb to those of them that the OS backs
+ *    with transparent huge pages, from Rss and AnonHugePages in
+ *    /proc/self/smaps.  Returns -1 if smaps cannot be read, and 0
+ *    otherwise.
+ */
+int mem_hugepage_usage(size_t *resident_kb, size_t *huge_kb)
+{
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    char line[256], *end = mem_start_brk + mem_narenas * mem_arena_max;
+    unsigned long lo, hi;
+    size_t kb;
+    int in = 0;
+
+    *resident_kb = *huge_kb = 0;
+    if (fp == NULL)
+	return -1;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+	/* A mapping's line "lo-hi perms ..." starts its fields */
+	if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2)
+	    in = (char *)lo < end && (char *)hi > mem_start_brk;
+	else if (in && sscanf(line, "Rss: %zu kB", &kb) == 1)
+	    *resident_kb += kb;
+	else if (in && sscanf(line, "AnonHugePages: %zu kB", &kb) == 1)
+	    *huge_kb += kb;
+    }
+    fclose(fp);
+    return 0;
+}
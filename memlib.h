@@ -1,8 +1,31 @@
+#define MEM_MAXARENAS 64   /* most arenas mem_init_arenas can set up */
+#define MEM_MAXNODES  64   /* most NUMA nodes the arenas are spread over */
+#define MEM_MAXCPUS 1024   /* most CPUs whose NUMA node is known */
+#define MEM_HUGEPAGE (2 << 20) /* size of a transparent huge page */
+
+extern int mem_hugepages;  /* if set, mem_init backs the heap with huge pages */
+
 void mem_init(void);               
+void mem_init_size(size_t size);
+void mem_init_arenas(int narenas, size_t size);
 void mem_deinit(void);
 void *mem_sbrk(intptr_t incr);
+void *mem_sbrk_arena(int arena, intptr_t incr);
+size_t mem_trim_arena(int arena, size_t size);
 void mem_reset_brk(void); 
+void *mem_fresh_lo(int arena);
+size_t mem_release(void *p, size_t size);
+void *mem_map(size_t size);
+void mem_unmap(void *p, size_t size);
+void *mem_remap(void *p, size_t oldsize, size_t newsize);
+int mem_arenas(void);
+int mem_arena_of(const void *p);
+void *mem_arena_lo(int arena);
+int mem_nodes(void);
+int mem_arena_node(int arena);
+int mem_cpu_node(int cpu);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
 size_t mem_pagesize(void);
+int mem_hugepage_usage(size_t *resident_kb, size_t *huge_kb);
@@ -7,27 +7,206 @@
  * than necessary; the assignment only requires 8-byte alignment.  The
  * minimum block size is four words.
  *
+ * Only free blocks have a footer.  Every header carries a PREV_ALLOC bit
+ * that tells whether the previous block is allocated, so coalesce reads
+ * the previous block's footer only when that block is free.
+ *
  * This allocator uses the size of a pointer, e.g., sizeof(void *), to
  * define the size of a word.  This allocator also uses the standard
  * type uintptr_t to define unsigned integers that are the same size
  * as a pointer, i.e., sizeof(uintptr_t) == sizeof(void *).
+ *
+ * Requests of at most SLAB_MAXSIZE bytes are served by a slab tier in front
+ * of the segregated lists.  Each size class owns a list of slab pages, which
+ * are ordinary allocated blocks of SLAB_PAGESIZE bytes holding equally sized
+ * objects and a stack of the free ones.  Slab objects carry a one word
+ * header with the SLAB_BIT set, so mm_free can tell them apart from boundary
+ * tag blocks by their header alone.
+ *
+ * When built with MM_TLSF, each power-of-two class is further split into
+ * SL_COUNT linear sub-classes (Two-Level Segregated Fit).  Bitmaps over the
+ * classes and sub-classes let find_fit take the head of the first list
+ * whose blocks are all big enough, so every operation runs in bounded time.
+ *
+ * Without MM_TLSF, free blocks of the last size class are not kept on a
+ * list.  They form a top-down splay tree keyed on (size, address) that
+ * reuses the block_list links as child pointers, which gives O(log n)
+ * amortized best fit for the largest requests.  The TLSF build keeps the
+ * last class on sub-lists like the others, since a single splay can take
+ * time linear in the size of the tree.
+ *
+ * Requests of at least HUGE_THRESHOLD bytes bypass the arenas.  Each gets a
+ * mapping of its own from memlib, which is given back to the OS on free and
+ * resized with mremap on realloc, so that growing one never copies it.
+ *
+ * The heap state lives at the start of each memlib arena, so there can be
+ * one independent heap per arena.  A thread allocates from its home arena,
+ * picked by the CPU it first runs on among the arenas on that CPU's NUMA
+ * node, and a block is always freed back to the arena whose address range
+ * holds it, and so to the node that its memory comes from.
+ *
+ * When built with MM_DEFER, freed blocks of at most QUICK_MAXSIZE bytes are
+ * not coalesced.  They go on per-size quick lists and stay marked allocated,
+ * so that their neighbors do not merge with them either, and are handed
+ * out again as they are.  The quick lists are consolidated, i.e., their
+ * blocks are freed and coalesced for real, when find_fit misses or when
+ * they hold more than QUICK_LIMIT bytes.
+ *
+ * When built with MM_THREADS, each arena has its own lock.  Each thread
+ * keeps a bounded cache of freed slab objects per size class in front of
+ * the arenas, so that most small requests never take a lock, and refills or
+ * flushes half a cache at a time when it runs dry or overflows.  A thread
+ * that frees a block of an arena other than its own pushes it on a lock-free
+ * stack of that arena's remote frees, which the next thread to allocate
+ * from the arena drains under its lock.
+ *
+ * When built with MM_STATS, the allocator counts its work per size class
+ * for mm_stats().  In the threaded build each thread counts into its
+ * cache, and mm_stats() sums the caches of the live threads and the
+ * counters left behind by the threads that exited.
+ *
+ * When built with MM_PLACE, placement keeps small and large blocks apart
+ * and small objects within cache lines.  Slab objects smaller than a cache
+ * line get slots that divide the line, starting on a line boundary, so
+ * that no object straddles two lines.  Blocks larger than a slab page are
+ * carved from the high end of the free block they are placed in, leaving
+ * the low end to slab pages and small blocks.
+ *
+ * When built with MM_HARDEN, every link stored in a free block or object
+ * is mangled with a random key (safe-linking), removing a block from its
+ * free list checks that its neighbors point back at it, and every free
+ * checks in constant time that the block is allocated and that its header
+ * agrees with its neighbors.  The first sign of corruption aborts.  When
+ * built with MM_CANARY, every block ends with a hash of its address and a
+ * second key, which is checked when the block is freed or resized.
  */
 
+#define _GNU_SOURCE	/* For sched_getcpu(). */
+
 #include <math.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "memlib.h"
 #include "mm.h"
 
+#if MM_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+#if MM_HARDEN || MM_CANARY
+#include <sys/random.h>
+#include <time.h>
+#endif
+
 /* Basic constants and macros: */
 #define WSIZE      sizeof(void *) /* Word and header/footer size (bytes) */
 #define DSIZE      (2 * WSIZE)    /* Doubleword size (bytes) */
 #define CHUNKSIZE  (1 << 12)      /* Extend heap by this amount (bytes) */
 
+/*
+ * Adaptive heap growth.  extend_heap asks memlib for at least the arena's
+ * growth size, which doubles when extensions come fewer than GROW_BURST
+ * block allocations apart and halves when they come GROW_QUIET or more
+ * apart, or when the free lists hold over a quarter of the heap.  It is
+ * kept between CHUNKSIZE and GROW_MAX, but no extension asks for more
+ * than the larger of the request and 1/64 of the heap, so a small heap
+ * still grows tightly.
+ */
+#define GROW_MAX    (256 * 1024)
+#define GROW_BURST  16
+#define GROW_QUIET  1024
+
+#define NCLASSES   MM_NCLASSES    /* Number of power-of-two size classes */
+
+/* Linear sub-classes per size class, and the resulting number of lists. */
+#if MM_TLSF
+#define SL_SHIFT   3
+#else
+#define SL_SHIFT   0
+#endif
+#define SL_COUNT   (1 << SL_SHIFT)
+#define NLISTS     (NCLASSES * SL_COUNT)
+
+/*
+ * Without MM_TLSF the last class is a splay tree whose root is kept in this
+ * list's head, and IS_TREE(index) tells whether list "index" is the tree.
+ */
+#define TREE_INDEX  ((NCLASSES - 1) << SL_SHIFT)
+#if MM_TLSF
+#define IS_TREE(index)  false
+#else
+#define IS_TREE(index)  ((index) == TREE_INDEX)
+#endif
+
+/*
+ * Read and write a link stored in a free block or object at address linkp.
+ * With MM_HARDEN a link is stored XORed with harden_key and with linkp
+ * shifted right by 12 bits (safe-linking), so that an overflow or a use
+ * after free that writes a link yields a wild pointer, rather than the
+ * address the attacker chose.
+ */
+#if MM_HARDEN
+#define PROTECT(linkp, p)  \
+	((void *)(((uintptr_t)(linkp) >> 12) ^ harden_key ^ (uintptr_t)(p)))
+#else
+#define PROTECT(linkp, p)  ((void *)(p))
+#endif
+#define GET_LINK(linkp)     PROTECT(linkp, *(linkp))
+#define SET_LINK(linkp, p)  (*(linkp) = PROTECT(linkp, p))
+
+/*
+ * With MM_CANARY every request gets CANARY_SIZE more bytes, and the last
+ * word of its block holds the canary of the block's address: the address
+ * XORed with canary_key and mixed by a 64-bit hash finalizer.  The canary
+ * has a key of its own, so that a canary read out of a block reveals
+ * nothing of harden_key.  Without it the canary routines compile away.
+ */
+#if MM_CANARY
+#define CANARY_SIZE  WSIZE
+#define CANARY(bp)   canary_hash((uintptr_t)(bp) ^ canary_key)
+#define CANARYP(bp)  ((char *)(bp) + block_usable(bp) - WSIZE)
+#else
+#define CANARY_SIZE  0
+#define canary_set(bp)    (bp)
+#define canary_resize(bp, usable)  ((void)(usable), (bp))
+#define canary_check(bp)  ((void)0)
+#endif
+
+/* Read and write the links of free list node np. */
+#define PREV_FREE(np)         GET_LINK(&(np)->prev_list)
+#define NEXT_FREE(np)         GET_LINK(&(np)->next_list)
+#define SET_PREV_FREE(np, p)  SET_LINK(&(np)->prev_list, p)
+#define SET_NEXT_FREE(np, p)  SET_LINK(&(np)->next_list, p)
+
+/* Tree nodes reuse a free block's list links as their child pointers. */
+#define LEFT(np)            PREV_FREE(np)
+#define RIGHT(np)           NEXT_FREE(np)
+#define SET_LEFT(np, p)     SET_PREV_FREE(np, p)
+#define SET_RIGHT(np, p)    SET_NEXT_FREE(np, p)
+
+/* Is the key (size, addr) less than the key of tree node np? */
+#define KEY_LT(size, addr, np)  \
+	((size) < GET_SIZE(HDRP(np)) || \
+	    ((size) == GET_SIZE(HDRP(np)) && (char *)(addr) < (char *)(np)))
+
+/*
+ * The hash of free block bp, a multiplicative hash of its address.  Each
+ * arena keeps the sum of the hashes of the free blocks of every class, and
+ * a pass of the heap checker compares it with the free blocks it walked.
+ */
+#define CHECK_HASH(bp)  ((uintptr_t)(bp) * (uintptr_t)0x9e3779b97f4a7c15ULL)
+
+/* The heap checker looks for a block at most this deep in the tree. */
+#define CHECK_DEPTH  64
+
 #define MAX(x, y)  ((x) > (y) ? (x) : (y))  
+#define MIN(x, y)  ((x) < (y) ? (x) : (y))
 
 /* Pack a size and allocated bit into a word. */
 #define PACK(size, alloc)  ((size) | (alloc))
@@ -39,36 +218,373 @@
 /* Read the size and allocated fields from address p. */
 #define GET_SIZE(p)   (GET(p) & ~(DSIZE - 1))
 #define GET_ALLOC(p)  (GET(p) & 0x1)
+#define GET_SLAB(p)   (GET(p) & SLAB_BIT)
+
+/* Read, set and clear the previous block allocated bit at address p. */
+#define PREV_ALLOC         0x4
+#define GET_PREV_ALLOC(p)  (GET(p) & PREV_ALLOC)
 
-/* Given block ptr bp, compute address of its header and footer. */
+/* 
+ * The header of a block that realloc has grown has the REALLOC_BIT set, and
+ * the block is given headroom when it grows again.  With 8-byte alignment
+ * there is no spare bit, and blocks are never given headroom.
+ */
+#if UINTPTR_MAX > UINT32_MAX
+#define REALLOC_BIT  0x8
+#else
+#define REALLOC_BIT  0
+#endif
+#define HEADROOM(size)  ((size) + (size) / 2)  /* Payload with headroom */
+
+/* Set and clear the realloc bit at address p, holding the arena's lock. */
+#define SET_REALLOC(p)  PUT(p, GET(p) | REALLOC_BIT)
+#define CLR_REALLOC(p)  PUT(p, GET(p) & ~(uintptr_t)REALLOC_BIT)
+
+/*
+ * While a thread holds the heap lock it may flip the PREV_ALLOC bit of a
+ * block that another thread owns, and the owner reads its own header
+ * without the lock.  In the threaded build both go through atomics.
+ */
+#if MM_THREADS
+#define GET_OWN(p)  __atomic_load_n((uintptr_t *)(p), __ATOMIC_RELAXED)
+#define SET_PREV_ALLOC(p)  \
+	__atomic_fetch_or((uintptr_t *)(p), PREV_ALLOC, __ATOMIC_RELAXED)
+#define CLR_PREV_ALLOC(p)  \
+	__atomic_fetch_and((uintptr_t *)(p), ~(uintptr_t)PREV_ALLOC, \
+	    __ATOMIC_RELAXED)
+#else
+#define GET_OWN(p)         GET(p)
+#define SET_PREV_ALLOC(p)  PUT(p, GET(p) | PREV_ALLOC)
+#define CLR_PREV_ALLOC(p)  PUT(p, GET(p) & ~(uintptr_t)PREV_ALLOC)
+#endif
+
+/* Given block ptr bp, compute address of its header and (if free) footer. */
 #define HDRP(bp)  ((char *)(bp) - WSIZE)
 #define FTRP(bp)  ((char *)(bp) + GET_SIZE(HDRP(bp)) - DSIZE)
 
-/* Given block ptr bp, compute address of next and previous blocks. */
+/* 
+ * Given block ptr bp, compute address of next and previous blocks.  The
+ * previous block can only be found if it is free.
+ */
 #define NEXT_BLKP(bp)  ((char *)(bp) + GET_SIZE(((char *)(bp) - WSIZE)))
 #define PREV_BLKP(bp)  ((char *)(bp) - GET_SIZE(((char *)(bp) - DSIZE)))
 
+/* Slab tier constants and macros: */
+#define SLAB_BIT       0x2        /* Header bit marking a slab object */
+#define SLAB_MAXSIZE   256        /* Largest payload served by a slab (bytes) */
+#define SLAB_PAGESIZE  CHUNKSIZE  /* Block size of every slab page (bytes) */
+#define SLAB_NCLASSES  ((int)(SLAB_MAXSIZE / DSIZE) + 1)
+#define CACHE_LINE     64         /* Cache line size (bytes) */
+
+/* Smallest block that place() carves from the high end with MM_PLACE. */
+#define PLACE_HIGH     (SLAB_PAGESIZE + DSIZE)
+
+/* Size class of a "size" byte request and the object size of a class. */
+#define SLAB_CLASS(size)  (((size) + WSIZE + (DSIZE - 1)) / DSIZE - 1)
+#define SLAB_SIZE(cls)    (((size_t)(cls) + 1) * DSIZE)
+#if MM_PLACE
+/* A slot smaller than a cache line is rounded up to divide the line. */
+#define SLAB_SLOT(cls)  \
+	(SLAB_SIZE(cls) > CACHE_LINE || CACHE_LINE % SLAB_SIZE(cls) == 0 ? \
+	    SLAB_SIZE(cls) : CACHE_LINE)
+#else
+#define SLAB_SLOT(cls)    SLAB_SIZE(cls)
+#endif
+
+/*
+ * Offset of the first object header from the start of a slab page, chosen
+ * so that every object payload is doubleword aligned.
+ */
+#define SLAB_OBJOFF  \
+	(DSIZE * ((sizeof(struct slab_page) + WSIZE + (DSIZE - 1)) / DSIZE) - \
+	    WSIZE)
+
+/*
+ * Payload of the first object of a slab page.  With MM_PLACE it is moved up
+ * to the next cache line, by at most SLAB_OBJPAD bytes.
+ */
+#if MM_PLACE
+#define SLAB_OBJPAD  (CACHE_LINE - DSIZE)
+#define SLAB_FIRST(page)  \
+	((char *)(((uintptr_t)(page) + SLAB_OBJOFF + WSIZE + SLAB_OBJPAD) & \
+	    ~(uintptr_t)(CACHE_LINE - 1)))
+#else
+#define SLAB_OBJPAD  0
+#define SLAB_FIRST(page)  ((char *)(page) + SLAB_OBJOFF + WSIZE)
+#endif
+
+/* Number of objects that fit in a slab page of class cls. */
+#define SLAB_NOBJS(cls)  \
+	((SLAB_PAGESIZE - WSIZE - SLAB_OBJOFF - SLAB_OBJPAD) / SLAB_SLOT(cls))
+
+/* Given a slab page and an object number, compute that object's payload. */
+#define SLAB_OBJP(page, i)  \
+	(SLAB_FIRST(page) + (i) * SLAB_SLOT((page)->class))
+
+/* Quick list constants and macros: */
+#define QUICK_MAXSIZE  1024          /* Largest block put on a quick list */
+#define QUICK_LIMIT    (64 * 1024)   /* Quick list bytes that consolidate */
+#define NQUICK         ((int)(QUICK_MAXSIZE / DSIZE) - 1)
+#define QUICK_INDEX(size)  ((size) / DSIZE - 2)
+
+/* Huge block constants and macros: */
+#define HUGE_THRESHOLD  (128 * 1024)  /* Smallest payload mapped on its own */
+#define HUGE_OFF        (2 * DSIZE)   /* Payload offset in the mapping */
+
+/* 
+ * A huge block's header has both the SLAB_BIT and PREV_ALLOC set, which no
+ * other header has, since slab objects never carry PREV_ALLOC.
+ */
+#define HUGE_BITS     (SLAB_BIT | PREV_ALLOC)
+#define IS_HUGE(hdr)  (((hdr) & HUGE_BITS) == HUGE_BITS)
+
+/* Mapping size for a "size" byte payload, and payload to mapping and back. */
+#define HUGE_MAPSIZE(size)  \
+	((((size) + HUGE_OFF) + mem_pagesize() - 1) & ~(mem_pagesize() - 1))
+#define HUGE_PAYLOAD(hp)  ((char *)(hp) + HUGE_OFF)
+#define HUGE_BLOCK(bp)    ((struct huge_block *)((char *)(bp) - HUGE_OFF))
+
+#if MM_THREADS
+#define HUGE_LOCK()    pthread_mutex_lock(&huge_lock)
+#define HUGE_UNLOCK()  pthread_mutex_unlock(&huge_lock)
+#else
+#define HUGE_LOCK()
+#define HUGE_UNLOCK()
+#endif
+
+/* Per-thread cache constants: */
+#define TCACHE_COUNT  16  /* Most objects a thread caches per slab class */
+
+/*
+ * With MM_HARDEN an object in a thread's cache has its allocated bit clear,
+ * so that freeing it a second time is caught there too.
+ */
+#if MM_HARDEN
+#define TCACHE_PARK(bp)  PUT(HDRP(bp), GET(HDRP(bp)) & ~(uintptr_t)0x1)
+#define TCACHE_TAKE(bp)  PUT(HDRP(bp), GET(HDRP(bp)) | 0x1)
+#else
+#define TCACHE_PARK(bp)  ((void)0)
+#define TCACHE_TAKE(bp)  ((void)0)
+#endif
+
+/*
+ * Add "n" to the statistics counter "ctr" of the calling thread.  A
+ * counter's class is that of the block holding a "size" byte payload, and
+ * allocations and frees are both counted in the class of the block "bp"
+ * itself, so that the two agree whatever size was asked for.  Without
+ * MM_STATS the counters and their arguments compile away.
+ */
+#if MM_STATS
+#define STAT_ADD(ctr, n)   stat_add(&stats_get()->ctr, (n))
+#define STAT_CLASS(size)   (freelistindex(MAX(2 * DSIZE, (size) + WSIZE)) >> \
+	SL_SHIFT)
+#define STAT_BLOCK(bp)     STAT_CLASS(block_usable(bp))
+#else
+#define STAT_ADD(ctr, n)   ((void)0)
+#endif
+
+/*
+ * Lock the arena "ap" and make it the one the internal routines work on, and
+ * unlock it again.  Only one arena is ever locked at a time.
+ */
+#if MM_THREADS
+#define LOCK(ap)    (pthread_mutex_lock(&(ap)->lock), arenap = (ap))
+#define UNLOCK(ap)  pthread_mutex_unlock(&(ap)->lock)
+#else
+#define LOCK(ap)    (arenap = (ap))
+#define UNLOCK(ap)
+#endif
+
 /* Global variables: */
-static char *heap_listp; /* Pointer to first block */  
-static struct block_list **free_list_segregatedp; 
-/* Pointer to first block_list of the free_list.*/  
+#if MM_THREADS
+static __thread struct arena *arenap; /* Arena locked by this thread */
+static unsigned int heap_epoch;  /* Bumped by mm_init to void old caches */
+static unsigned int arena_next;  /* Next arena for round-robin assignment */
+static int ncpus;                /* Online CPUs, as of mm_init */
+#else
+static struct arena *arenap;     /* Arena the internal routines work on */
+static struct arena *homep;      /* Arena allocated from first */
+#endif
+static struct huge_block *huge_listp; /* Every mapped huge block */
+static unsigned int check_next;  /* Arena that mm_check goes on with */
+#if MM_HARDEN
+static uintptr_t harden_key;     /* Random key of links */
+#endif
+#if MM_CANARY
+static uintptr_t canary_key;     /* Random key of canaries */
+#endif
+#if MM_THREADS
+static pthread_mutex_t huge_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+#if MM_STATS
+#if MM_THREADS
+static struct tcache *tcache_listp;  /* Caches of the registered threads */
+static struct mm_stats stats_exited; /* Counters of the exited threads */
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#else
+static struct mm_stats stats;        /* The counters */
+#endif
+static size_t stats_peak;            /* Largest heap size seen */
+#endif
+
+/* Function prototypes for the arenas: */
+static int arena_init(int index);
+static struct arena *arena_of(void *bp);
+static struct arena *home_arena(void);
+static void move_home(struct arena *ap);
+#if MM_THREADS
+static int node_arena(int node, unsigned int slot);
+#endif
+static void *arena_alloc(size_t size, size_t align, char **freshp);
+#if MM_THREADS
+static void remote_push(struct arena *ap, void *bp);
+static void remote_drain(void);
+#endif
 
 /* Function prototypes for internal helper routines: */
+static void *alloc_aligned(size_t size, size_t align);
+static void *malloc_any(size_t size);
+static void free_any(void *bp, int cls);
+static size_t block_usable(void *bp);
+static void *alloc_block(size_t size);
+static size_t alloc_blocks(size_t size, size_t n, void **out);
 static void *coalesce(void *bp);
 static void *extend_heap(size_t words);
+static size_t grow_size(size_t size);
 static void *find_fit(size_t asize);
-static void place(void *bp, size_t asize);
+static void free_block(void *bp);
+static void *place(void *bp, size_t asize);
+static void *realloc_block(void *bp, size_t size);
+static void split_block(void *bp, size_t asize);
+static size_t trim_top(size_t pad);
+#if MM_DEFER
+static void quick_push(void *bp);
+static void *quick_pop(size_t asize);
+static void consolidate(void);
+#endif
+static size_t release_free(void);
+
+/* Function prototypes for huge blocks: */
+static void *huge_alloc(size_t size);
+static void huge_free(void *bp);
+static void *huge_resize(void *bp, size_t size);
+static void huge_link(struct huge_block *hp);
+static void huge_unlink(struct huge_block *hp);
+
+/* Function prototypes for the slab tier: */
+static void *slab_alloc(int cls);
+static void slab_free(void *bp);
+static struct slab_page *slab_new_page(int cls);
+static void slab_push(struct slab_page *page);
+static void slab_unlink(struct slab_page *page);
+static void slab_release(void);
+
+#if MM_THREADS
+/* Function prototypes for the per-thread caches: */
+static struct tcache *tcache_get(void);
+static void *tcache_alloc(int cls);
+static void tcache_free(void *bp, int cls);
+static void tcache_flush(struct tcache *tc, int cls, unsigned int keep);
+static void tcache_destroy(void *arg);
+static void tcache_key_init(void);
+#endif
+
+#if MM_STATS
+/* Function prototypes for the statistics: */
+static struct mm_stats *stats_get(void);
+static void stat_add(size_t *ctr, size_t n);
+static void stat_peak(void);
+static void stats_sum(struct mm_stats *dst, struct mm_stats *src);
+#endif
+
+#if MM_HARDEN || MM_CANARY
+/* Function prototypes for the integrity checks: */
+static void harden_fail(const char *what, void *bp);
+#endif
+#if MM_HARDEN
+static void harden_block(void *bp);
+static bool harden_link(void *np);
+#endif
+#if MM_CANARY
+static uintptr_t canary_hash(uintptr_t x);
+static void *canary_set(void *bp);
+static void *canary_resize(void *bp, size_t oldusable);
+static void canary_check(void *bp);
+#endif
+
+/* Function prototypes for heap snapshots: */
+static int snap_arena(FILE *fp);
+static bool snap_is_slab(void *bp);
+#if MM_DEFER
+static int ptr_cmp(const void *a, const void *b);
+#endif
 
 /* Function prototypes for heap consistency checker routines: */
 static void checkblock(void *bp);
 static void checkheap(bool verbose);
+static bool check_walk(size_t *budgetp);
+static void check_merged(void *bp);
+static void check_fail(const char *fmt, ...);
+static void checkslabs(void);
+#if MM_DEFER
+static void checkquick(void);
+#endif
 static void printblock(void *bp); 
 
 /* Helper functions that we created. */
 static int freelistindex(size_t size);
+static int next_nonempty(int index);
 static struct block_list *remove_free(void* blockp);
 static void add_to_free(void* bp, int index);
 
+/* Function prototypes for the splay tree of the largest free blocks: */
+static struct block_list *tree_splay(struct block_list *np, size_t size,
+    void *addr);
+static void tree_insert(struct block_list *bp);
+static void tree_remove(struct block_list *bp);
+static struct block_list *tree_bestfit(size_t asize);
+static bool tree_missing(struct block_list *bp);
+static void checktree(struct block_list *np, bool verbose);
+
+/* 
+ * The state of one heap, kept at the start of its memlib arena.  The lists
+ * and bitmaps follow it in the same metadata area.
+ */
+struct arena
+{
+#if MM_THREADS
+	pthread_mutex_t lock;
+	void *remote_frees;	/* Blocks freed by other arenas' threads. */
+#endif
+	int index;		/* The memlib arena number. */
+	char *heap_listp;	/* Pointer to first block */
+	struct block_list **free_list_segregatedp;
+	/* Pointer to first block_list of the free_list.*/
+	struct slab_page **slab_listp;	/* Pages with free objects, by class */
+	unsigned int fl_bitmap;		/* Bit i set iff class i is non-empty */
+	unsigned int *sl_bitmapp;	/* Per class, bit j set iff list j non-empty */
+	size_t free_bytes;	/* Bytes on the free lists and in the tree */
+	size_t allocs;		/* Boundary tag block allocations */
+	size_t grow_allocs;	/* Value of allocs at the last extension */
+	size_t grow;		/* Least bytes extend_heap asks memlib for */
+	uintptr_t free_hash[NCLASSES];	/* Sum of CHECK_HASH, by class */
+	char *check_curp;	/* Next block to check, NULL between passes */
+	uintptr_t check_hash[NCLASSES];	/* free_hash of the blocks checked */
+	size_t check_bytes;	/* Free bytes among the blocks checked */
+	size_t check_errors;	/* Errors the checker found */
+#if MM_DEFER
+	void **quick_listp;	/* Freed blocks not yet coalesced, by size */
+	size_t quick_bytes;	/* Bytes on the quick lists */
+#endif
+};
+
+/* Links at the start of every huge block's mapping */
+struct huge_block
+{
+	struct huge_block *prev;
+	struct huge_block *next;
+};
+
 /* Struct for segregated free list */
 struct block_list
 {
@@ -76,6 +592,38 @@ struct block_list
 	struct block_list *next_list;
 };
 
+/* Header at the start of every slab page's payload */
+struct slab_page
+{
+	struct slab_page *prev_page;
+	struct slab_page *next_page;
+	void *free_objs;	/* Stack of freed objects, linked by payload. */
+	uint16_t nlive;		/* Number of allocated objects. */
+	uint16_t ncarved;	/* Objects handed out at least once. */
+	uint32_t class;		/* Size class of the page's objects. */
+};
+
+#if MM_THREADS
+/* A thread's cache of freed slab objects, linked by payload, per class */
+struct tcache
+{
+	void *bins[SLAB_NCLASSES];
+	unsigned int counts[SLAB_NCLASSES];
+	unsigned int epoch;	/* heap_epoch when the bins were filled. */
+	struct arena *home;	/* Arena this thread allocates from. */
+	bool registered;	/* Is the exit destructor set for this thread? */
+#if MM_STATS
+	struct mm_stats stats;	/* This thread's counters, as of epoch. */
+	struct tcache *prev;	/* Links in the list of registered caches. */
+	struct tcache *next;
+#endif
+};
+
+static __thread struct tcache tcache;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+#endif
+
 /* 
  * Requires:
  *   None.
@@ -87,36 +635,52 @@ struct block_list
 int
 mm_init(void) 
 {
-	// Initialize memory for storing the free list in the heap, error check.
-	if ((free_list_segregatedp = mem_sbrk(2 * 12 * sizeof(void*))) ==
-		(void*)-1)
-		return (-1);
-
-	// Initialize free list to all NULL.
-	int i;
-	for (i = 0; i < 12; i ++) {
-		free_list_segregatedp[i] = NULL;
-	}
-
-	// Correctly align the start of the heap_list to account for free list.
-	if ((heap_listp = mem_sbrk(4 * WSIZE)) == (void *)-1)
- 		return (-1);
-
-	PUT(heap_listp, 0);                            /* Alignment padding */
-	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1)); /* Prologue header */ 
-	PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
-	PUT(heap_listp + (3 * WSIZE), PACK(0, 1));     /* Epilogue header */
-	heap_listp += 2 * WSIZE;
 
-	// Initial Extention of heap by minimum chunk size, then add to freelist.
-	void *bp = extend_heap(CHUNKSIZE / WSIZE);
-	if (bp == NULL) {
-		return -1;
+	/* Huge blocks still mapped belong to the old heaps. */
+	while (huge_listp != NULL)
+		huge_free(HUGE_PAYLOAD(huge_listp));
+
+	/* The new heaps get new keys. */
+#if MM_HARDEN
+	if (getrandom(&harden_key, sizeof(harden_key), 0) !=
+	    sizeof(harden_key))
+		harden_key = (uintptr_t)&harden_key ^ (uintptr_t)time(NULL);
+#endif
+#if MM_CANARY
+	if (getrandom(&canary_key, sizeof(canary_key), 0) !=
+	    sizeof(canary_key))
+		canary_key = (uintptr_t)&canary_key ^ (uintptr_t)clock();
+#endif
+
+#if MM_STATS
+	/* Count from scratch.  Threads reset their own counters on the epoch. */
+#if MM_THREADS
+	pthread_mutex_lock(&stats_lock);
+	memset(&stats_exited, 0, sizeof(stats_exited));
+	pthread_mutex_unlock(&stats_lock);
+#else
+	memset(&stats, 0, sizeof(stats));
+#endif
+	__atomic_store_n(&stats_peak, 0, __ATOMIC_RELAXED);
+#endif
+
+#if MM_THREADS
+	/* Objects cached by any thread belong to the old heaps. */
+	heap_epoch++;
+	arena_next = 0;
+	ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	/* Set up a heap in every arena that memlib provides. */
+	for (int i = 0; i < mem_arenas(); i++) {
+		if (arena_init(i) == -1)
+			return (-1);
 	}
-	add_to_free(bp, freelistindex(GET_SIZE(HDRP(bp))));
-
-	// Optionally Check heap.
-	// checkheap(true);
+	arenap = mem_arena_lo(0);
+#if !MM_THREADS
+	homep = arenap;
+#endif
+	check_next = 0;
 	return (0);
 }
 
@@ -132,34 +696,132 @@ mm_init(void)
 void *
 mm_malloc(size_t size) 
 {
-	size_t asize;      /* Adjusted block size */
-	void *bp;
 
 	/* Ignore spurious requests. */
-	if (size == 0)
+	if (size == 0 || size + CANARY_SIZE < size)
 		return (NULL);
+	return (canary_set(malloc_any(size + CANARY_SIZE)));
+}
 
-	/* Adjust block size to include overhead and alignment reqs. */
-	if (size <= DSIZE)
-		asize = 2 * DSIZE;
-	else
-		asize = DSIZE * ((size + DSIZE + (DSIZE - 1)) / DSIZE);
+/*
+ * Requires:
+ *   "size" is not zero.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload, leaving any
+ *   canary to the caller.  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
+ */
+static void *
+malloc_any(size_t size)
+{
+	void *bp;
 
-	/* Search the free list for a fit. */
-	bp = find_fit(asize);
-	if (bp != NULL) {
-		place(bp, asize);
+	if (size >= HUGE_THRESHOLD) {
+		/* Huge requests get a mapping of their own. */
+		bp = huge_alloc(size);
+#if MM_THREADS
+	} else if (size <= SLAB_MAXSIZE) {
+		/* Small requests are served from the thread's cache first. */
+		bp = tcache_alloc(SLAB_CLASS(size));
+#endif
+	} else {
+		/* Small requests are served by the slab tier, the rest by blocks. */
+		bp = arena_alloc(size, 0, NULL);
+	}
+	if (bp != NULL)
+		STAT_ADD(allocs[STAT_BLOCK(bp)], 1);
+	return (bp);
+} 
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a zeroed block with room for "nmemb" objects of "size" bytes
+ *   each.  Memory that memlib has not handed out since it was mapped or
+ *   given back already reads as zero, so only the part of the block below
+ *   the arena's fresh memory and the stale footer a block from extend_heap
+ *   may end with are cleared.  Returns the address of this block if the
+ *   allocation was successful and NULL otherwise.
+ */
+void *
+mm_calloc(size_t nmemb, size_t size)
+{
+	size_t bytes, dirty;
+	char *bp, *fresh;
+
+	if (nmemb != 0 && size > SIZE_MAX / nmemb)
+		return (NULL);
+	bytes = nmemb * size;
+
+	/* Huge blocks are new mappings, which the OS has zeroed. */
+	if (bytes == 0 || bytes >= HUGE_THRESHOLD)
+		return (mm_malloc(bytes));
+
+	/* Slab objects are small enough to clear without a second thought. */
+	if (bytes <= SLAB_MAXSIZE) {
+		if ((bp = mm_malloc(bytes)) != NULL)
+			memset(bp, 0, bytes);
 		return (bp);
 	}
 
-	/* No fit found.  Get more memory and place the block. */
-	if ((bp = extend_heap(asize / WSIZE)) == NULL)  
+	bytes += CANARY_SIZE;
+	if ((bp = arena_alloc(bytes, 0, &fresh)) == NULL)
 		return (NULL);
-	place(bp, asize);
-	
-	//checkheap(true);
-	return (bp);
-} 
+	STAT_ADD(allocs[STAT_BLOCK(bp)], 1);
+	dirty = fresh > bp ? MIN(bytes, (size_t)(fresh - bp)) : 0;
+	memset(bp, 0, dirty);
+	if (dirty < bytes)
+		memset(bp + bytes - DSIZE, 0, DSIZE);
+	return (canary_set(bp));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Allocate a block with at least "size" bytes of payload whose address
+ *   is a multiple of "alignment", a power of two.  The padding in front of
+ *   the aligned block is split off and freed.  Returns the address of this
+ *   block if the allocation was successful and NULL otherwise.
+ */
+void *
+mm_memalign(size_t alignment, size_t size)
+{
+	void *bp;
+
+	if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+		return (NULL);
+
+	/* Every block and huge payload already has this much alignment. */
+	if (alignment <= DSIZE || (alignment <= HUGE_OFF && 
+	    size >= HUGE_THRESHOLD))
+		return (mm_malloc(size));
+
+	if (size == 0 || size > SIZE_MAX / 2 - alignment)
+		return (NULL);
+	if ((bp = arena_alloc(size + CANARY_SIZE, alignment, NULL)) != NULL)
+		STAT_ADD(allocs[STAT_BLOCK(bp)], 1);
+	return (canary_set(bp));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   C11's aligned_alloc.  The same as mm_memalign, since "size" need not be
+ *   a multiple of "alignment".
+ */
+void *
+mm_aligned_alloc(size_t alignment, size_t size)
+{
+
+	return (mm_memalign(alignment, size));
+}
 
 /* 
  * Requires:
@@ -171,20 +833,86 @@ mm_malloc(size_t size)
 void
 mm_free(void *bp)
 {
-	size_t size;
 
 	/* Ignore spurious requests. */
 	if (bp == NULL)
 		return;
+	canary_check(bp);
+	STAT_ADD(frees[STAT_BLOCK(bp)], 1);
+	free_any(bp, -1);
+}
+
+/*
+ * Requires:
+ *   "bp" is either NULL or the address of an allocated block, and "size"
+ *   is the size it was last allocated or reallocated with.
+ *
+ * Effects:
+ *   Free a block like mm_free, taking the size class from "size" instead
+ *   of the block.  A slab object then goes into the thread's cache without
+ *   a look at its page.  The cache class may be smaller than the page's,
+ *   if mm_realloc kept the object in place, which only gives a later
+ *   request more room than it needs.
+ */
+void
+mm_free_sized(void *bp, size_t size)
+{
+
+	/* Ignore spurious requests. */
+	if (bp == NULL)
+		return;
+	canary_check(bp);
+	STAT_ADD(frees[STAT_BLOCK(bp)], 1);
+	size += CANARY_SIZE;
+	free_any(bp, size <= SLAB_SLOT(SLAB_NCLASSES - 1) - WSIZE ? 
+	    (int)SLAB_CLASS(size) : -1);
+}
 
-	/* Free and coalesce the block. */
-	size = GET_SIZE(HDRP(bp));
-	PUT(HDRP(bp), PACK(size, 0));
-	PUT(FTRP(bp), PACK(size, 0));
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block, and "cls" is either -1 or
+ *   at most the slab class of "bp" if it is a slab object.
+ *
+ * Effects:
+ *   Free a block and coalesce it if possible.
+ */
+static void
+free_any(void *bp, int cls)
+{
 
-	/* Adding to free list done in coalesce */
-	coalesce(bp);
-	//checkheap(true);
+	/* Huge blocks go straight back to the OS. */
+	if (IS_HUGE(GET_OWN(HDRP(bp)))) {
+		huge_free(bp);
+		return;
+	}
+
+#if MM_THREADS
+	/* Slab objects go back to their page through the thread's cache. */
+	if (GET_OWN(HDRP(bp)) & SLAB_BIT) {
+		if (cls < 0)
+			cls = ((struct slab_page *)GET_SIZE(HDRP(bp)))->class;
+		tcache_free(bp, cls);
+		return;
+	}
+#else
+	(void)cls;
+#endif
+
+	/* Everything else goes back to the arena that owns it. */
+	struct arena *ap = arena_of(bp);
+#if MM_THREADS
+	/* Leave blocks of other arenas for whoever allocates from them next. */
+	if (ap != home_arena()) {
+		remote_push(ap, bp);
+		return;
+	}
+#endif
+	LOCK(ap);
+	if (GET_SLAB(HDRP(bp)))
+		slab_free(bp);
+	else
+		free_block(bp);
+	UNLOCK(ap);
 }
 
 /*
@@ -199,11 +927,15 @@ mm_free(void *bp)
  *   Otherwise, a new block is allocated and the contents of the old block
  *   "ptr" are copied to that new block.  Returns the address of this new
  *   block if the allocation was successful and NULL otherwise.
+ *
+ *   A block that has to be copied when it grows for the second time or
+ *   later is given HEADROOM, so that a block grown in many small steps is
+ *   copied only every so often.
  */
 void *
 mm_realloc(void *ptr, size_t size)
 {
-	size_t oldsize;
+	size_t oldsize, oldusable, want;
 	void *newptr;
 
 	/* If size == 0 then this is just free, and we return NULL. */
@@ -216,28 +948,67 @@ mm_realloc(void *ptr, size_t size)
 	if (ptr == NULL)
 		return (mm_malloc(size));
 
-	/* 
-	 * Check if we can just coalesce the next block into current one.
-	 * This way, we don't have to ever copy more memory, and can instead
-	 * just return the same pointer after coalescing
-	 */
+	/* From here on, "size" includes the canary. */
+	canary_check(ptr);
+	if (size + CANARY_SIZE < size)
+		return (NULL);
+	size += CANARY_SIZE;
+	want = size;
+	oldusable = block_usable(ptr);
+
+	if (IS_HUGE(GET_OWN(HDRP(ptr)))) {
+		/* A huge block stays huge by resizing its mapping. */
+		if (size >= HUGE_THRESHOLD)
+			return (canary_resize(huge_resize(ptr, size), oldusable));
+		oldsize = GET_SIZE(HDRP(ptr)) - HUGE_OFF;
+	} else if (GET_OWN(HDRP(ptr)) & SLAB_BIT) {
+		/* A slab object is kept if the request still fits in its slot. */
+		struct slab_page *page = (struct slab_page *)GET_SIZE(HDRP(ptr));
+		oldsize = SLAB_SLOT(page->class) - WSIZE;
+		if (size <= oldsize)
+			return (canary_set(ptr));
+	} else {
+		struct arena *ap = arena_of(ptr);
+		uintptr_t hdr = GET_OWN(HDRP(ptr));
+		oldsize = (hdr & ~(DSIZE - 1)) - WSIZE;
+
+		/* 
+		 * A block that grew before keeps its headroom, and gets more if
+		 * it has to be copied.
+		 */
+		if (hdr & REALLOC_BIT) {
+			if (size <= oldsize && oldsize <= HEADROOM(size))
+				return (canary_set(ptr));
+			if (size > oldsize && HEADROOM(size) > size)
+				want = HEADROOM(size);
+		}
 
-	oldsize = GET_SIZE(HDRP(ptr));
-	size_t nextsize = GET_SIZE(HDRP(NEXT_BLKP(ptr)));
-	if (oldsize + nextsize > size && !GET_ALLOC(HDRP(NEXT_BLKP(ptr)))) {
-		oldsize += nextsize;
-		remove_free(NEXT_BLKP(ptr));
-		PUT(HDRP(ptr), PACK(oldsize, 1));
-		PUT(FTRP(ptr), PACK(oldsize, 1));
-		return ptr;
+		/* Try to resize the block where it is before copying it. */
+		LOCK(ap);
+		newptr = realloc_block(ptr, size);
+		if (newptr != NULL && size > oldsize)
+			SET_REALLOC(HDRP(newptr));
+		UNLOCK(ap);
+		if (newptr != NULL)
+			return (canary_resize(newptr, oldusable));
 	}
 
-	newptr = mm_malloc(size);
+	newptr = malloc_any(want);
+	if (newptr == NULL && want != size)
+		newptr = malloc_any(size);
 
 	/* If realloc() fails the original block is left untouched  */
 	if (newptr == NULL)
 		return (NULL);
 
+	/* A boundary tag block that grew is marked for headroom. */
+	if (size > oldsize && !(GET_OWN(HDRP(newptr)) & SLAB_BIT)) {
+		struct arena *ap = arena_of(newptr);
+		LOCK(ap);
+		SET_REALLOC(HDRP(newptr));
+		UNLOCK(ap);
+	}
+
 	/* Copy the old data. */
 	if (size < oldsize)
 		oldsize = size;
@@ -246,238 +1017,2448 @@ mm_realloc(void *ptr, size_t size)
 	/* Free the old block. */
 	mm_free(ptr);
 
-	return (newptr);
+	return (canary_resize(newptr, oldusable));
 }
 
-/*
- * The following routines are internal helper routines.
- */
-
 /*
  * Requires:
- *   "bp" is the address of a newly freed block.
+ *   "out" has room for "n" pointers.
  *
  * Effects:
- *   Perform boundary tag coalescing.  Returns the address of the coalesced
- *   block.
+ *   Allocate up to "n" blocks with at least "size" bytes of payload each,
+ *   and store their addresses in "out".  The blocks are carved from one
+ *   free block under a single lock round trip where possible.  Returns the
+ *   number of blocks allocated, which is less than "n" only if the heap ran
+ *   out of memory, and zero if "size" is zero.
  */
-static void *
-coalesce(void *bp) 
+size_t
+mm_malloc_batch(size_t size, size_t n, void **out)
 {
+	size_t i = 0, bsize = size + CANARY_SIZE;
 
-	size_t size = GET_SIZE(HDRP(bp));
-	bool prev_alloc = GET_ALLOC(FTRP(PREV_BLKP(bp)));
-	bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
-	void *temp_bp;
+	/* Ignore spurious requests. */
+	if (size == 0 || bsize < size)
+		return (0);
 
-	if (prev_alloc && next_alloc) {                 /* Case 1 */
-		// No Coalesce Possible in this case, as both alloced.
-		temp_bp = (struct block_list*) bp;
-	} else if (prev_alloc && !next_alloc) {         /* Case 2 */
-		// Coalesce next block into current one.
-		remove_free(NEXT_BLKP(bp));
-		temp_bp = (struct block_list*) bp;
-		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
-		PUT(HDRP(bp), PACK(size, 0));
-		PUT(FTRP(bp), PACK(size, 0));
-	} else if (!prev_alloc && next_alloc) {         /* Case 3 */
-		// Coalesce current block into previous.
-		temp_bp = remove_free(PREV_BLKP(bp));
-		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
-		PUT(FTRP(bp), PACK(size, 0));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-		bp = PREV_BLKP(bp);
-	} else {                                        /* Case 4 */
-		// Coalesce next and current block into previous.
-		remove_free(NEXT_BLKP(bp));
-		temp_bp = remove_free(PREV_BLKP(bp));
-		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
-		    GET_SIZE(FTRP(NEXT_BLKP(bp)));
-		PUT(HDRP(PREV_BLKP(bp)), PACK(size, 0));
-		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
-		bp = PREV_BLKP(bp);
+	/* 
+	 * Huge blocks, single blocks and, with MM_THREADS, slab objects, which
+	 * come from the thread's cache, gain nothing from a batch.
+	 */
+	if (bsize < HUGE_THRESHOLD && n > 1 &&
+	    !(MM_THREADS && bsize <= SLAB_MAXSIZE)) {
+		struct arena *ap = home_arena();
+		LOCK(ap);
+#if MM_THREADS
+		remote_drain();
+#endif
+		if (bsize <= SLAB_MAXSIZE) {
+			while (i < n && (out[i] = slab_alloc(SLAB_CLASS(bsize))) !=
+			    NULL)
+				i++;
+		} else
+			i = alloc_blocks(bsize, n, out);
+		UNLOCK(ap);
+		for (size_t j = 0; j < i; j++) {
+			STAT_ADD(allocs[STAT_BLOCK(out[j])], 1);
+			(void)canary_set(out[j]);
+		}
 	}
 
-	int index = freelistindex(size);
-	add_to_free(temp_bp,index);
-
-	//checkheap(true);
-	return (temp_bp);
+	/* Allocate the rest one by one, e.g., if the home arena is full. */
+	while (i < n && (out[i] = mm_malloc(size)) != NULL)
+		i++;
+	return (i);
 }
 
-/* 
+/*
  * Requires:
- *   The size of the block to extend the heap by, in words.
+ *   Every entry of "ptrs" is either the address of an allocated block or
+ *   NULL.
  *
  * Effects:
- *   Extend the heap with a free block and return that block's address.
+ *   Free the "n" blocks in "ptrs", which are left sorted by address.  The
+ *   blocks of each arena are freed under a single lock round trip, and
+ *   blocks that are next to each other are merged before they are freed,
+ *   so that each resulting free block is put on a free list only once.
  */
-static void *
-extend_heap(size_t words) 
+void
+mm_free_batch(void **ptrs, size_t n)
 {
-	size_t size;
-	void *bp;
+	struct arena *ap;
+	size_t i, j, size;
+	char *bp;
 
-	/* Allocate an even number of words to maintain alignment. */
-	size = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
-	if ((bp = mem_sbrk(size)) == (void *)-1)  
-		return (NULL);
+	if (n == 1) {
+		mm_free(ptrs[0]);
+		return;
+	}
 
-	/* Initialize free block header/footer and the epilogue header. */
-	PUT(HDRP(bp), PACK(size, 0));         /* Free block header */
+	/* Batches are small, so an insertion sort beats qsort. */
+	for (i = 1; i < n; i++) {
+		void *key = ptrs[i];
+		for (j = i; j > 0 && (uintptr_t)ptrs[j - 1] > (uintptr_t)key; j--)
+			ptrs[j] = ptrs[j - 1];
+		ptrs[j] = key;
+	}
+	i = 0;
+	while (i < n) {
+		bp = ptrs[i];
+		if (bp == NULL || IS_HUGE(GET_OWN(HDRP(bp))) ||
+		    (MM_THREADS && (GET_OWN(HDRP(bp)) & SLAB_BIT))) {
+			mm_free(bp);
+			i++;
+			continue;
+		}
+
+		/* Free the run of blocks of this arena that follows. */
+		ap = arena_of(bp);
+		LOCK(ap);
+		while (i < n && (bp = ptrs[i]) != NULL &&
+		    !IS_HUGE(GET_OWN(HDRP(bp))) && arena_of(bp) == ap) {
+			canary_check(bp);
+			if (GET_SLAB(HDRP(bp))) {
+#if MM_THREADS
+				break;
+#else
+				STAT_ADD(frees[STAT_BLOCK(bp)], 1);
+				slab_free(bp);
+				i++;
+				continue;
+#endif
+			}
+			size = GET_SIZE(HDRP(bp));
+			STAT_ADD(frees[STAT_BLOCK(bp)], 1);
+			for (j = i + 1; j < n && ptrs[j] == bp + size; j++) {
+				canary_check(ptrs[j]);
+#if MM_HARDEN
+				harden_block(ptrs[j]);
+#endif
+				STAT_ADD(frees[STAT_BLOCK(ptrs[j])], 1);
+				size += GET_SIZE(HDRP(ptrs[j]));
+			}
+			if (j > i + 1) {
+				PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)) | 1));
+				check_merged(bp);
+				STAT_ADD(coalesces[STAT_CLASS(size - WSIZE)], j - i - 1);
+			}
+			free_block(bp);
+			i = j;
+		}
+		UNLOCK(ap);
+	}
+}
+
+/*
+ * Requires:
+ *   "ptr" is the address of an allocated block.
+ *
+ * Effects:
+ *   Returns the number of bytes of payload that the block "ptr" can hold,
+ *   which includes any headroom that mm_realloc gave it.
+ */
+size_t
+mm_usable_size(void *ptr)
+{
+
+	return (block_usable(ptr) - CANARY_SIZE);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block.
+ *
+ * Effects:
+ *   Returns the number of bytes of payload that the block "bp" can hold,
+ *   including its canary.
+ */
+static size_t
+block_usable(void *bp)
+{
+	uintptr_t hdr = GET_OWN(HDRP(bp));
+
+	if (IS_HUGE(hdr))
+		return ((hdr & ~(DSIZE - 1)) - HUGE_OFF);
+	if (hdr & SLAB_BIT) {
+		struct slab_page *page = (struct slab_page *)(hdr & ~(DSIZE - 1));
+		return (SLAB_SLOT(page->class) - WSIZE);
+	}
+	return ((hdr & ~(DSIZE - 1)) - WSIZE);
+}
+
+/*
+ * Requires:
+ *   "ptr" is the address of an allocated block with at least "size" bytes
+ *   of payload.
+ *
+ * Effects:
+ *   Give back the headroom of the block "ptr" beyond "size" bytes of
+ *   payload, and stop giving it headroom until it grows again.  Slab
+ *   objects and huge blocks have no headroom and are left as they are.
+ */
+void
+mm_shrink_to_fit(void *ptr, size_t size)
+{
+	struct arena *ap;
+
+	if (GET_OWN(HDRP(ptr)) & SLAB_BIT)
+		return;
+	size += CANARY_SIZE;
+	ap = arena_of(ptr);
+	LOCK(ap);
+	CLR_REALLOC(HDRP(ptr));
+	split_block(ptr,
+	    MAX(2 * DSIZE, DSIZE * ((size + WSIZE + (DSIZE - 1)) / DSIZE)));
+	UNLOCK(ap);
+	(void)canary_set(ptr);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Return the objects in the calling thread's caches to the heap.  Threads
+ *   that exit do this on their own, so this is only needed by a thread that
+ *   stops using the allocator but keeps running.  Does nothing unless the
+ *   allocator was built with MM_THREADS.
+ */
+void
+mm_thread_exit(void)
+{
+#if MM_THREADS
+	struct tcache *tc = tcache_get();
+
+	for (int cls = 0; cls < SLAB_NCLASSES; cls++)
+		tcache_flush(tc, cls, 0);
+#endif
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Give unused memory of every arena back to the OS.  Empty slab pages are
+ *   freed first, even the last page of a class.  Then the free block at the
+ *   end of each heap is shrunk to "pad" bytes and the heap with it, and the
+ *   whole pages inside every other free block are released in place.
+ *   Returns the number of bytes given back.
+ */
+size_t
+mm_trim(size_t pad)
+{
+	size_t released = 0;
+
+	for (int i = 0; i < mem_arenas(); i++) {
+		struct arena *ap = mem_arena_lo(i);
+
+		LOCK(ap);
+#if MM_THREADS
+		remote_drain();
+#endif
+#if MM_DEFER
+		consolidate();
+#endif
+		slab_release();
+		released += trim_top(pad);
+		released += release_free();
+		UNLOCK(ap);
+	}
+	return (released);
+}
+
+/*
+ * Requires:
+ *   "sp" is the address of a struct mm_stats.
+ *
+ * Effects:
+ *   Fill in "*sp" with the allocator's counters since mm_init, summed over
+ *   every thread.  All of them are zero unless the allocator was built
+ *   with MM_STATS.
+ */
+void
+mm_stats(struct mm_stats *sp)
+{
+
+	memset(sp, 0, sizeof(*sp));
+#if MM_STATS
+#if MM_THREADS
+	pthread_mutex_lock(&stats_lock);
+	stats_sum(sp, &stats_exited);
+	for (struct tcache *tc = tcache_listp; tc != NULL; tc = tc->next) {
+		if (tc->epoch == heap_epoch)
+			stats_sum(sp, &tc->stats);
+	}
+	pthread_mutex_unlock(&stats_lock);
+#else
+	stats_sum(sp, &stats);
+#endif
+	sp->peak_heap = __atomic_load_n(&stats_peak, __ATOMIC_RELAXED);
+#endif
+}
+
+/*
+ * Requires:
+ *   "fp" is a stream open for writing.
+ *
+ * Effects:
+ *   Write a snapshot of every arena's blocks to "fp", in the format that
+ *   mm.h describes, labelled with "label".  Returns 0 if successful and -1
+ *   if writing failed.
+ */
+int
+mm_snapshot(FILE *fp, uint64_t label)
+{
+	struct mm_snap snap;
+	struct huge_block *hp;
+	int err = 0;
+
+	snap.magic = MM_SNAP_MAGIC;
+	snap.narenas = mem_arenas();
+	snap.label = label;
+	snap.heap_size = mem_heapsize();
+	snap.huge_blocks = snap.huge_bytes = 0;
+	HUGE_LOCK();
+	for (hp = huge_listp; hp != NULL; hp = hp->next) {
+		snap.huge_blocks++;
+		snap.huge_bytes += GET_SIZE(HDRP(HUGE_PAYLOAD(hp)));
+	}
+	HUGE_UNLOCK();
+	if (fwrite(&snap, sizeof(snap), 1, fp) != 1)
+		return (-1);
+
+	for (int i = 0; i < mem_arenas(); i++) {
+		struct arena *ap = mem_arena_lo(i);
+
+		LOCK(ap);
+		err |= snap_arena(fp);
+		UNLOCK(ap);
+	}
+	return (err);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check at most "budget" blocks of the heap, going on from the block
+ *   where the last call stopped, so that calls with a small budget spread
+ *   the checks of a whole pass over time.  The arenas are checked in turn,
+ *   and each at most to the end of one pass per call, where its free lists
+ *   are checked against the blocks seen.  Each block checked costs
+ *   constant time, a block in the tree included, whose lookup stops
+ *   CHECK_DEPTH levels down, so a call costs O("budget") plus O(1) per
+ *   size class at the end of a pass.  Returns
+ *   the number of errors found, each of which is also printed.
+ */
+size_t
+mm_check(size_t budget)
+{
+	size_t errors = 0;
+
+	for (int n = 0; n < mem_arenas() && budget > 0; n++) {
+		unsigned int i = __atomic_load_n(&check_next, __ATOMIC_RELAXED);
+		struct arena *ap = mem_arena_lo(i % mem_arenas());
+		size_t before;
+		bool done;
+
+		LOCK(ap);
+		before = ap->check_errors;
+		done = check_walk(&budget);
+		errors += ap->check_errors - before;
+		UNLOCK(ap);
+		if (!done)
+			break;
+		__atomic_store_n(&check_next, i + 1, __ATOMIC_RELAXED);
+	}
+	return (errors);
+}
+
+/*
+ * The following routines manage the arenas.
+ */
+
+/* 
+ * Requires:
+ *   "index" is a memlib arena with an empty heap.
+ *
+ * Effects:
+ *   Set up the arena's state, free lists and prologue and epilogue, and
+ *   extend its heap by a first chunk.  Returns 0 if successful and -1
+ *   otherwise.
+ */
+static int
+arena_init(int index) 
+{
+	struct arena *ap;
+
+	// Initialize memory for the arena, free lists, slab lists and bitmaps.
+	size_t metasize = sizeof(struct arena) +
+	    (NLISTS + SLAB_NCLASSES + MM_DEFER * NQUICK) * sizeof(void *) +
+	    NCLASSES * sizeof(unsigned int);
+	metasize = DSIZE * ((metasize + (DSIZE - 1)) / DSIZE);
+	if ((ap = mem_sbrk_arena(index, metasize)) == (void *)-1)
+		return (-1);
+	ap->index = index;
+#if MM_THREADS
+	pthread_mutex_init(&ap->lock, NULL);
+	ap->remote_frees = NULL;
+#endif
+	ap->free_list_segregatedp = (struct block_list **)(ap + 1);
+	ap->slab_listp = (struct slab_page **)(ap->free_list_segregatedp +
+	    NLISTS);
+	ap->sl_bitmapp = (unsigned int *)(ap->slab_listp + SLAB_NCLASSES);
+#if MM_DEFER
+	ap->quick_listp = (void **)(ap->sl_bitmapp + NCLASSES);
+	for (int q = 0; q < NQUICK; q++)
+		ap->quick_listp[q] = NULL;
+	ap->quick_bytes = 0;
+#endif
+
+	// Initialize free lists and slab lists to all NULL.
+	int i;
+	for (i = 0; i < NLISTS; i ++) {
+		ap->free_list_segregatedp[i] = NULL;
+	}
+	ap->fl_bitmap = 0;
+	for (i = 0; i < NCLASSES; i++) {
+		ap->sl_bitmapp[i] = 0;
+		ap->free_hash[i] = 0;
+	}
+	for (i = 0; i < SLAB_NCLASSES; i++) {
+		ap->slab_listp[i] = NULL;
+	}
+	ap->free_bytes = 0;
+	ap->allocs = 0;
+	ap->grow_allocs = 0;
+	ap->grow = CHUNKSIZE;
+	ap->check_curp = NULL;
+	ap->check_errors = 0;
+
+	// Correctly align the start of the heap_list to account for free list.
+	char *heap_listp;
+	if ((heap_listp = mem_sbrk_arena(index, 4 * WSIZE)) == (void *)-1)
+ 		return (-1);
+
+	PUT(heap_listp, 0);                            /* Alignment padding */
+	PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, PREV_ALLOC | 1)); /* Prologue */
+	PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1)); /* Prologue footer */ 
+	PUT(heap_listp + (3 * WSIZE), PACK(0, PREV_ALLOC | 1)); /* Epilogue */
+	ap->heap_listp = heap_listp + 2 * WSIZE;
+
+	// Initial Extention of heap by minimum chunk size, then add to freelist.
+	LOCK(ap);
+	void *bp = extend_heap(CHUNKSIZE / WSIZE);
+	if (bp != NULL)
+		add_to_free(bp, freelistindex(GET_SIZE(HDRP(bp))));
+
+	// Optionally Check heap.
+	// checkheap(true);
+	UNLOCK(ap);
+	return (bp != NULL ? 0 : -1);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block or slab object.
+ *
+ * Effects:
+ *   Returns the arena that owns "bp".
+ */
+static struct arena *
+arena_of(void *bp)
+{
+
+	return (mem_arena_lo(mem_arena_of(bp)));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the arena that the calling thread allocates from first.  A
+ *   thread starts out with the arena of the CPU it first allocates on,
+ *   among the arenas on that CPU's NUMA node.  If the CPU is unknown or
+ *   there are more arenas than CPUs, threads are given those arenas in
+ *   turn instead.
+ */
+static struct arena *
+home_arena(void)
+{
+#if MM_THREADS
+	struct tcache *tc = tcache_get();
+	int cpu, slot;
+
+	if (tc->home == NULL) {
+		slot = cpu = sched_getcpu();
+		if (mem_arenas() > ncpus || cpu < 0)
+			slot = __atomic_fetch_add(&arena_next, 1, __ATOMIC_RELAXED);
+		tc->home = mem_arena_lo(node_arena(mem_cpu_node(cpu), slot));
+	}
+	return (tc->home);
+#else
+	return (homep);
+#endif
+}
+
+#if MM_THREADS
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the index of the arena in position "slot", modulo their number,
+ *   among the arenas on NUMA node "node", or among all the arenas if none
+ *   is on that node.
+ */
+static int
+node_arena(int node, unsigned int slot)
+{
+	int i, n = 0;
+
+	for (i = 0; i < mem_arenas(); i++)
+		n += (mem_arena_node(i) == node);
+	if (n == 0)
+		return (slot % mem_arenas());
+	slot %= n;
+	for (i = 0; mem_arena_node(i) != node || slot-- > 0; i++)
+		;
+	return (i);
+}
+#endif
+
+/*
+ * Requires:
+ *   "ap" is an arena.
+ *
+ * Effects:
+ *   Make "ap" the arena that the calling thread allocates from first.
+ */
+static void
+move_home(struct arena *ap)
+{
+
+#if MM_THREADS
+	tcache_get()->home = ap;
+#else
+	homep = ap;
+#endif
+}
+
+/* 
+ * Requires:
+ *   "size" is greater than zero.
+ *
+ * Effects:
+ *   Allocate a slab object or block with at least "size" bytes of payload
+ *   from the calling thread's home arena, after taking back the blocks that
+ *   other threads freed into it.  If that arena is out of memory,
+ *   try the others in turn, and move home to the first one that has room.
+ *   An "align" above DSIZE asks for a block aligned to it.  If "freshp" is
+ *   not NULL, it is set to where the fresh memory of the block's arena
+ *   started before the allocation.  Returns the address of this block if
+ *   the allocation was successful and NULL otherwise.
+ */
+static void *
+arena_alloc(size_t size, size_t align, char **freshp)
+{
+	struct arena *ap = home_arena();
+	void *bp;
+
+	for (int i = 0; i < mem_arenas(); i++) {
+		LOCK(ap);
+#if MM_THREADS
+		remote_drain();
+#endif
+		if (freshp != NULL)
+			*freshp = mem_fresh_lo(ap->index);
+		if (align > DSIZE)
+			bp = alloc_aligned(size, align);
+		else if (size <= SLAB_MAXSIZE)
+			bp = slab_alloc(SLAB_CLASS(size));
+		else
+			bp = alloc_block(size);
+		UNLOCK(ap);
+		if (bp != NULL) {
+			if (i > 0)
+				move_home(ap);
+			return (bp);
+		}
+		ap = mem_arena_lo((ap->index + 1) % mem_arenas());
+	}
+	return (NULL);
+}
+
+#if MM_THREADS
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block or slab object of the arena
+ *   "ap".
+ *
+ * Effects:
+ *   Push "bp" on the arena's stack of remote frees without taking its lock.
+ *   The block stays allocated until the stack is drained.
+ */
+static void
+remote_push(struct arena *ap, void *bp)
+{
+	void *head = __atomic_load_n(&ap->remote_frees, __ATOMIC_RELAXED);
+
+	do {
+		SET_LINK((void **)bp, head);
+	} while (!__atomic_compare_exchange_n(&ap->remote_frees, &head, bp,
+	    true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Take the whole stack of remote frees of arenap at once and free and
+ *   coalesce every block on it.
+ */
+static void
+remote_drain(void)
+{
+	void *bp, *next;
+
+	if (__atomic_load_n(&arenap->remote_frees, __ATOMIC_RELAXED) == NULL)
+		return;
+	bp = __atomic_exchange_n(&arenap->remote_frees, NULL,
+	    __ATOMIC_ACQUIRE);
+	for (; bp != NULL; bp = next) {
+		next = GET_LINK((void **)bp);
+		if (GET_SLAB(HDRP(bp)))
+			slab_free(bp);
+		else
+			free_block(bp);
+	}
+}
+#endif
+
+/*
+ * The following routines are internal helper routines.  Those that touch the
+ * heap work on arenap and expect the caller to hold its lock.
+ */
+
+/* 
+ * Requires:
+ *   "size" is greater than zero.
+ *
+ * Effects:
+ *   Allocate a boundary tag block with at least "size" bytes of payload.
+ *   Returns the address of this block if the allocation was successful and
+ *   NULL otherwise.
+ */
+static void *
+alloc_block(size_t size)
+{
+	size_t asize;      /* Adjusted block size */
+	void *bp;
+
+	/* Adjust block size to include the header and alignment reqs. */
+	asize = MAX(2 * DSIZE, DSIZE * ((size + WSIZE + (DSIZE - 1)) / DSIZE));
+	arenap->allocs++;
+
+#if MM_DEFER
+	/* A quick list block of the exact size is reused as it is. */
+	if (asize <= QUICK_MAXSIZE && (bp = quick_pop(asize)) != NULL)
+		return (bp);
+#endif
+
+	/* Search the free list for a fit. */
+	bp = find_fit(asize);
+#if MM_DEFER
+	if (bp == NULL && arenap->quick_bytes > 0) {
+		consolidate();
+		bp = find_fit(asize);
+	}
+#endif
+	if (bp != NULL)
+		return (place(bp, asize));
+
+	/* No fit found.  Get more memory and place the block. */
+	if ((bp = extend_heap(asize / WSIZE)) == NULL)  
+		return (NULL);
+	bp = place(bp, asize);
+	
+	//checkheap(true);
+	return (bp);
+}
+
+/* 
+ * Requires:
+ *   "size" is greater than zero and "align" is a power of two greater than
+ *   DSIZE.
+ *
+ * Effects:
+ *   Allocate a boundary tag block with at least "size" bytes of payload at
+ *   a multiple of "align".  A block with room for the padding is taken,
+ *   the padding in front of the aligned address is split off as a block of
+ *   its own and freed, and so is any excess at the end.  Returns the
+ *   address of the aligned block if the allocation was successful and NULL
+ *   otherwise.
+ */
+static void *
+alloc_aligned(size_t size, size_t align)
+{
+	size_t asize, csize, pad;
+	char *bp, *alignp;
+
+	/* Adjust block size to include the header and alignment reqs. */
+	asize = MAX(2 * DSIZE, DSIZE * ((size + WSIZE + (DSIZE - 1)) / DSIZE));
+
+	/* The padding is at least a minimum block, at most align + DSIZE. */
+	if ((bp = alloc_block(asize + align + DSIZE)) == NULL)
+		return (NULL);
+	if ((uintptr_t)bp % align != 0) {
+		alignp = (char *)(((uintptr_t)bp + 2 * DSIZE + (align - 1)) &
+		    ~(uintptr_t)(align - 1));
+		pad = alignp - bp;
+		csize = GET_SIZE(HDRP(bp));
+		PUT(HDRP(alignp), PACK(csize - pad, PREV_ALLOC | 1));
+		PUT(HDRP(bp), PACK(pad, GET_PREV_ALLOC(HDRP(bp)) | 1));
+		free_block(bp);
+		bp = alignp;
+	}
+	split_block(bp, asize);
+	return (bp);
+}
+
+/* 
+ * Requires:
+ *   "size" is greater than zero and "out" has room for "n" pointers.
+ *
+ * Effects:
+ *   Allocate "n" boundary tag blocks with at least "size" bytes of payload
+ *   each by carving them from one free block, and store their addresses in
+ *   "out".  Returns "n" if successful and zero otherwise.
+ */
+static size_t
+alloc_blocks(size_t size, size_t n, void **out)
+{
+	size_t asize, csize, total, rest;
+	uintptr_t prev_alloc;
+	char *bp;
+
+	/* Adjust block size to include the header and alignment reqs. */
+	asize = MAX(2 * DSIZE, DSIZE * ((size + WSIZE + (DSIZE - 1)) / DSIZE));
+	if (n == 0 || n > SIZE_MAX / asize)
+		return (0);
+	total = asize * n;
+	arenap->allocs += n;
+
+	/* Take one free block for all of them, or get more memory. */
+	bp = find_fit(total);
+#if MM_DEFER
+	if (bp == NULL && arenap->quick_bytes > 0) {
+		consolidate();
+		bp = find_fit(total);
+	}
+#endif
+	if (bp == NULL && (bp = extend_heap(total / WSIZE)) == NULL)
+		return (0);
+	csize = GET_SIZE(HDRP(bp));
+	prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	rest = csize - total;
+
+	/* The last block keeps any excess too small to be a block. */
+	for (size_t i = 0; i < n; i++) {
+		size_t bsize = (i == n - 1 && rest < 2 * DSIZE) ? 
+		    asize + rest : asize;
+		PUT(HDRP(bp), PACK(bsize, prev_alloc | 1));
+		prev_alloc = PREV_ALLOC;
+		out[i] = bp;
+		bp += bsize;
+	}
+	if (rest >= 2 * DSIZE) {
+		PUT(HDRP(bp), PACK(rest, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(rest, 0));
+		add_to_free(bp, freelistindex(rest));
+	} else
+		SET_PREV_ALLOC(HDRP(bp));
+	return (n);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated boundary tag block.
+ *
+ * Effects:
+ *   Free the block "bp" and coalesce it if possible.  With MM_DEFER, a
+ *   small block is put on its quick list instead.
+ */
+static void
+free_block(void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+
+#if MM_HARDEN
+	harden_block(bp);
+#endif
+#if MM_DEFER
+	if (size <= QUICK_MAXSIZE) {
+		quick_push(bp);
+		return;
+	}
+#endif
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+	PUT(FTRP(bp), PACK(size, 0));
+	CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+
+	/* Adding to free list done in coalesce */
+	coalesce(bp);
+	//checkheap(true);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a newly freed block.
+ *
+ * Effects:
+ *   Perform boundary tag coalescing.  Returns the address of the coalesced
+ *   block.
+ */
+static void *
+coalesce(void *bp) 
+{
+
+	size_t size = GET_SIZE(HDRP(bp));
+	bool prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	bool next_alloc = GET_ALLOC(HDRP(NEXT_BLKP(bp)));
+	void *temp_bp;
+
+	if (prev_alloc && next_alloc) {                 /* Case 1 */
+		// No Coalesce Possible in this case, as both alloced.
+		temp_bp = (struct block_list*) bp;
+	} else if (prev_alloc && !next_alloc) {         /* Case 2 */
+		// Coalesce next block into current one.
+		remove_free(NEXT_BLKP(bp));
+		temp_bp = (struct block_list*) bp;
+		size += GET_SIZE(HDRP(NEXT_BLKP(bp)));
+		PUT(HDRP(bp), PACK(size, PREV_ALLOC));
+		PUT(FTRP(bp), PACK(size, 0));
+	} else if (!prev_alloc && next_alloc) {         /* Case 3 */
+		// Coalesce current block into previous.
+		temp_bp = remove_free(PREV_BLKP(bp));
+		size += GET_SIZE(HDRP(PREV_BLKP(bp)));
+		PUT(FTRP(bp), PACK(size, 0));
+		PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
+		bp = PREV_BLKP(bp);
+	} else {                                        /* Case 4 */
+		// Coalesce next and current block into previous.
+		remove_free(NEXT_BLKP(bp));
+		temp_bp = remove_free(PREV_BLKP(bp));
+		size += GET_SIZE(HDRP(PREV_BLKP(bp))) + 
+		    GET_SIZE(FTRP(NEXT_BLKP(bp)));
+		PUT(HDRP(PREV_BLKP(bp)), PACK(size, PREV_ALLOC));
+		PUT(FTRP(NEXT_BLKP(bp)), PACK(size, 0));
+		bp = PREV_BLKP(bp);
+	}
+
+	int index = freelistindex(size);
+	if (!prev_alloc || !next_alloc) {
+		check_merged(temp_bp);
+		STAT_ADD(coalesces[index >> SL_SHIFT], 1);
+	}
+	add_to_free(temp_bp,index);
+
+	//checkheap(true);
+	return (temp_bp);
+}
+
+/* 
+ * Requires:
+ *   The size of the free block needed at the end of the heap, in words.
+ *
+ * Effects:
+ *   Extend the heap so that it ends with a free block of at least "words"
+ *   words, and return that block's address, off the free lists.  A free
+ *   block at the end of the heap is merged with the new memory, so only
+ *   the rest is asked for, rounded up to the arena's growth size.  If
+ *   memlib cannot give that much, only the rest is asked for.
+ */
+static void *
+extend_heap(size_t words) 
+{
+	char *epilogue = (char *)mem_sbrk_arena(arenap->index, 0) - WSIZE;
+	size_t size, need, tail = 0;
+	char *tailp = NULL;
+	void *bp;
+
+	/* Allocate an even number of words to maintain alignment. */
+	need = (words % 2) ? (words + 1) * WSIZE : words * WSIZE;
+
+	/* Take the free block at the end of the heap off its list. */
+	if (!GET_PREV_ALLOC(epilogue)) {
+		tail = GET_SIZE(epilogue - WSIZE);
+		tailp = epilogue + WSIZE - tail;
+		remove_free(tailp);
+		if (tail >= need)
+			return (tailp);
+	}
+	need -= tail;
+	size = grow_size(need);
+	if ((bp = mem_sbrk_arena(arenap->index, size)) == (void *)-1 &&
+	    (size == need ||
+	    (bp = mem_sbrk_arena(arenap->index, size = need)) == (void *)-1)) {
+		if (tailp != NULL)
+			add_to_free(tailp, freelistindex(tail));
+		return (NULL);
+	}
+	STAT_ADD(extend_calls, 1);
+	STAT_ADD(extend_bytes, size);
+#if MM_STATS
+	stat_peak();
+#endif
+
+	/* 
+	 * Initialize free block header/footer and the epilogue header.  The
+	 * old epilogue header knows whether the last block is allocated.
+	 */
+	PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp)))); /* Header */
 	PUT(FTRP(bp), PACK(size, 0));         /* Free block footer */
 	PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); /* New epilogue header */
 
-	/* No need to coalesce, because we only extend by necessary amount */
-	return bp;
+	/* Merge the old free block at the end with the new one. */
+	if (tailp != NULL) {
+		bp = tailp;
+		size += tail;
+		PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+		PUT(FTRP(bp), PACK(size, 0));
+		check_merged(bp);
+	}
+	return bp;
+}
+
+/*
+ * Requires:
+ *   "size" is a multiple of DSIZE.
+ *
+ * Effects:
+ *   Adapt arenap's growth size to how soon after the last extension this
+ *   one comes and to how much of the heap is free, and return the number
+ *   of bytes to extend the heap by for a request of "size" bytes.
+ */
+static size_t
+grow_size(size_t size)
+{
+	struct arena *ap = arenap;
+	size_t heap = (char *)mem_sbrk_arena(ap->index, 0) - (char *)ap;
+	size_t since = ap->allocs - ap->grow_allocs;
+
+	ap->grow_allocs = ap->allocs;
+	if (since >= GROW_QUIET || ap->free_bytes > heap / 4)
+		ap->grow = MAX(ap->grow / 2, CHUNKSIZE);
+	else if (since < GROW_BURST)
+		ap->grow = MIN(ap->grow * 2, GROW_MAX);
+	return (MAX(size, MIN(ap->grow, DSIZE * (heap / 64 / DSIZE))));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Shrink the free block at the end of arenap's heap to "pad" bytes,
+ *   rounded up to a valid block size, or drop it if "pad" is zero, and give
+ *   the rest back to memlib.  Returns the number of bytes that memlib gave
+ *   back to the OS, which is less than the bytes trimmed when the heap
+ *   does not end on a page.
+ */
+static size_t
+trim_top(size_t pad)
+{
+	char *epilogue = (char *)mem_sbrk_arena(arenap->index, 0) - WSIZE;
+	size_t size;
+	void *bp;
+
+	if (GET_PREV_ALLOC(epilogue))
+		return (0);
+	bp = epilogue - GET_SIZE(epilogue - WSIZE) + WSIZE;
+	size = GET_SIZE(HDRP(bp));
+	if (pad != 0)
+		pad = MAX(2 * DSIZE, DSIZE * ((pad + (DSIZE - 1)) / DSIZE));
+	if (size <= pad)
+		return (0);
+
+	remove_free(bp);
+	if (pad == 0)   /* New epilogue header */
+		PUT(HDRP(bp), PACK(0, GET_PREV_ALLOC(HDRP(bp)) | 1));
+	else {
+		PUT(HDRP(bp), PACK(pad, GET_PREV_ALLOC(HDRP(bp))));
+		PUT(FTRP(bp), PACK(pad, 0));
+		PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));  /* New epilogue header */
+		add_to_free(bp, freelistindex(pad));
+	}
+	return (mem_trim_arena(arenap->index, size - pad));
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Give the whole pages inside every free block of arenap's heap back to
+ *   the OS.  The header, list links and footer of each block are kept.
+ *   Returns the number of bytes given back.
+ */
+static size_t
+release_free(void)
+{
+	size_t released = 0;
+	char *bp;
+
+	for (bp = arenap->heap_listp; GET_SIZE(HDRP(bp)) > 0;
+	    bp = NEXT_BLKP(bp)) {
+		if (GET_ALLOC(HDRP(bp)) || GET_SIZE(HDRP(bp)) <= mem_pagesize())
+			continue;
+		released += mem_release(bp + sizeof(struct block_list),
+		    FTRP(bp) - (bp + sizeof(struct block_list)));
+	}
+	return (released);
+}
+
+/*
+ * Requires:
+ *   Size of the block we are looking for.
+ *
+ * Effects:
+ *   Find a fit for a block with "asize" bytes.  Returns that block's address
+ *   or NULL if no suitable block was found. 
+ */
+static void *
+find_fit(size_t asize)
+{
+	if (asize % WSIZE != 0)
+		printf("Error: you did something wrong");
+
+	/* Get the right free list head */
+	int index = freelistindex(asize);
+	struct block_list *freep = arenap->free_list_segregatedp[index];
+
+	STAT_ADD(fit_searches[index >> SL_SHIFT], 1);
+
+	/* The largest requests take the best fit from the tree. */
+	if (IS_TREE(index)) {
+		if ((freep = tree_bestfit(asize)) == NULL)
+			return (NULL);
+		STAT_ADD(fit_walks[TREE_INDEX >> SL_SHIFT], 1);
+		return (remove_free(freep));
+	}
+
+	/* 
+	 * Iterate through free list looking for free block.  TLSF only looks
+	 * at the head, so that the search takes constant time.
+	 */
+	while (freep != NULL) {
+		STAT_ADD(fit_walks[index >> SL_SHIFT], 1);
+		if (GET_SIZE(HDRP(freep)) >= asize)
+			return (remove_free(freep));
+#if MM_TLSF
+		break;
+#endif
+		freep = NEXT_FREE(freep);
+	}
+
+	/* 
+	 * Every block in a higher free list is big enough, so take the head of
+	 * the first non-empty one, which the bitmaps give us directly.
+	 */
+	if ((index = next_nonempty(index)) < 0)
+		return (NULL);
+	STAT_ADD(fit_walks[freelistindex(asize) >> SL_SHIFT], 1);
+	if (IS_TREE(index))
+		return (remove_free(tree_bestfit(asize)));
+	return (remove_free(arenap->free_list_segregatedp[index]));
+}
+
+/* 
+ * Requires:
+ *   "bp" is the address of a free block that is at least "asize" bytes.
+ *
+ * Effects:
+ *   Place a block of "asize" bytes at the start of the free block "bp" and
+ *   split that block if the remainder would be at least the minimum block
+ *   size.  With MM_PLACE, a block of at least PLACE_HIGH bytes is placed
+ *   at the end of "bp" instead.  Returns the address of the placed block.
+ */
+static void *
+place(void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));   
+	uintptr_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+
+#if MM_PLACE
+	if (asize >= PLACE_HIGH && (csize - asize) >= (2 * DSIZE)) {
+		/* Leave the low end free for small blocks. */
+		STAT_ADD(splits[STAT_CLASS(csize - WSIZE)], 1);
+		PUT(HDRP(bp), PACK(csize - asize, prev_alloc));
+		PUT(FTRP(bp), PACK(csize - asize, 0));
+		add_to_free(bp, freelistindex(csize - asize));
+
+		bp = NEXT_BLKP(bp);
+		PUT(HDRP(bp), PACK(asize, 1));
+		SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+		return (bp);
+	}
+#endif
+	if ((csize - asize) >= (2 * DSIZE)) { 
+		/* Case where we can split some excess memory off and reuse it */
+		STAT_ADD(splits[STAT_CLASS(csize - WSIZE)], 1);
+		PUT(HDRP(bp), PACK(asize, prev_alloc | 1));
+
+		void *restp = NEXT_BLKP(bp);
+		PUT(HDRP(restp), PACK(csize - asize, PREV_ALLOC));
+		PUT(FTRP(restp), PACK(csize - asize, 0));
+
+		/* Add the excess memory to free list */
+		int index = freelistindex((csize - asize));
+		add_to_free(restp,index);
+		return (bp);
+	} else {
+		/* Can't cut any excess memory off the allocated block */
+		PUT(HDRP(bp), PACK(csize, prev_alloc | 1));
+		SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+		return (bp);
+	}
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated boundary tag block.
+ *
+ * Effects:
+ *   Try to make the block "bp" hold "size" bytes of payload without
+ *   copying it elsewhere.  A block that is big enough is shrunk.  Otherwise
+ *   the block absorbs the next block if that one is free, and then the new
+ *   memory from extending the heap if it sits at the end of the heap.
+ *   Failing that, it moves down into a free previous block.  Returns the
+ *   new address of the block if successful and NULL, leaving the block
+ *   untouched, otherwise.
+ */
+static void *
+realloc_block(void *bp, size_t size)
+{
+	size_t asize, oldsize, nextsize, prevsize, total;
+	uintptr_t prev_alloc = GET_PREV_ALLOC(HDRP(bp));
+	void *nextp = NEXT_BLKP(bp);
+	void *prevp, *tailp;
+
+	/* Adjust block size to include the header and alignment reqs. */
+	asize = MAX(2 * DSIZE, DSIZE * ((size + WSIZE + (DSIZE - 1)) / DSIZE));
+	oldsize = GET_SIZE(HDRP(bp));
+	if (oldsize >= asize) {
+		split_block(bp, asize);
+		return (bp);
+	}
+	nextsize = GET_ALLOC(HDRP(nextp)) ? 0 : GET_SIZE(HDRP(nextp));
+	total = oldsize + nextsize;
+
+	/*
+	 * Grow in place, extending the heap if the block is its last one.
+	 * extend_heap takes a free next block off its list and merges it.
+	 */
+	if (total < asize && GET_SIZE(HDRP((char *)bp + total)) == 0) {
+		if ((tailp = extend_heap((asize - oldsize) / WSIZE)) != NULL) {
+			total = oldsize + GET_SIZE(HDRP(tailp));
+			nextsize = 0;
+		}
+	}
+	if (total >= asize) {
+		if (nextsize != 0)
+			remove_free(nextp);
+		PUT(HDRP(bp), PACK(total, prev_alloc | 1));
+		SET_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+		check_merged(bp);
+		split_block(bp, asize);
+		return (bp);
+	}
+
+	/* Move the payload down into the free previous block. */
+	prevsize = prev_alloc ? 0 : GET_SIZE(HDRP(bp) - WSIZE);
+	if (prevsize + total < asize)
+		return (NULL);
+	prevp = PREV_BLKP(bp);
+	remove_free(prevp);
+	if (nextsize != 0)
+		remove_free(nextp);
+	memmove(prevp, bp, oldsize - WSIZE);
+	PUT(HDRP(prevp), PACK(prevsize + total, GET_PREV_ALLOC(HDRP(prevp)) | 1));
+	SET_PREV_ALLOC(HDRP(NEXT_BLKP(prevp)));
+	check_merged(prevp);
+	split_block(prevp, asize);
+	return (prevp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated boundary tag block of at least
+ *   "asize" bytes, and "asize" is a valid block size.
+ *
+ * Effects:
+ *   Shrink the block "bp" to "asize" bytes if the excess can form a block of
+ *   its own, and free and coalesce that excess.
+ */
+static void
+split_block(void *bp, size_t asize)
+{
+	size_t csize = GET_SIZE(HDRP(bp));
+
+	if (csize - asize < 2 * DSIZE)
+		return;
+	STAT_ADD(splits[STAT_CLASS(csize - WSIZE)], 1);
+	PUT(HDRP(bp), PACK(asize, GET_PREV_ALLOC(HDRP(bp)) | 1));
+	bp = NEXT_BLKP(bp);
+	PUT(HDRP(bp), PACK(csize - asize, PREV_ALLOC));
+	PUT(FTRP(bp), PACK(csize - asize, 0));
+	CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+	coalesce(bp);
+}
+
+#if MM_DEFER
+/* 
+ * The following routines implement the quick lists of MM_DEFER.
+ */
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block of at most QUICK_MAXSIZE
+ *   bytes.
+ *
+ * Effects:
+ *   Push "bp" on the quick list of its size, leaving it marked allocated.
+ *   Consolidate the quick lists if they now hold more than QUICK_LIMIT
+ *   bytes.
+ */
+static void
+quick_push(void *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	int q = QUICK_INDEX(size);
+
+	CLR_REALLOC(HDRP(bp));
+	SET_LINK((void **)bp, arenap->quick_listp[q]);
+	arenap->quick_listp[q] = bp;
+	if ((arenap->quick_bytes += size) > QUICK_LIMIT)
+		consolidate();
+}
+
+/*
+ * Requires:
+ *   "asize" is a block size of at most QUICK_MAXSIZE bytes.
+ *
+ * Effects:
+ *   Pop a block of exactly "asize" bytes off its quick list.  Returns the
+ *   block, which is still marked allocated, or NULL if the list is empty.
+ */
+static void *
+quick_pop(size_t asize)
+{
+	int q = QUICK_INDEX(asize);
+	void *bp = arenap->quick_listp[q];
+
+	if (bp != NULL) {
+		arenap->quick_listp[q] = GET_LINK((void **)bp);
+		arenap->quick_bytes -= asize;
+	}
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Empty the quick lists of arenap, freeing and coalescing their blocks.
+ */
+static void
+consolidate(void)
+{
+	void *bp;
+	size_t size;
+
+	for (int q = 0; q < NQUICK; q++) {
+		size = (q + 2) * DSIZE;
+		while ((bp = quick_pop(size)) != NULL) {
+			PUT(HDRP(bp), PACK(size, GET_PREV_ALLOC(HDRP(bp))));
+			PUT(FTRP(bp), PACK(size, 0));
+			CLR_PREV_ALLOC(HDRP(NEXT_BLKP(bp)));
+			coalesce(bp);
+		}
+	}
+}
+#endif
+
+/* 
+ * The following routines implement huge blocks, which are mapped directly
+ * from the OS.
+ */
+
+/*
+ * Requires:
+ *   "size" is at least HUGE_THRESHOLD.
+ *
+ * Effects:
+ *   Map a huge block with at least "size" bytes of payload.  Returns the
+ *   address of this block if the allocation was successful and NULL
+ *   otherwise.
+ */
+static void *
+huge_alloc(size_t size)
+{
+	size_t msize = HUGE_MAPSIZE(size);
+	struct huge_block *hp;
+
+	if ((hp = mem_map(msize)) == (void *)-1)
+		return (NULL);
+	HUGE_LOCK();
+	huge_link(hp);
+	HUGE_UNLOCK();
+	PUT(HUGE_PAYLOAD(hp) - WSIZE, PACK(msize, HUGE_BITS | 1));
+#if MM_STATS
+	stat_peak();
+#endif
+	return (HUGE_PAYLOAD(hp));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a huge block.
+ *
+ * Effects:
+ *   Unmap the huge block "bp", releasing its pages to the OS.
+ */
+static void
+huge_free(void *bp)
+{
+	struct huge_block *hp = HUGE_BLOCK(bp);
+
+	HUGE_LOCK();
+#if MM_HARDEN
+	if ((hp->prev != NULL ? hp->prev->next : huge_listp) != hp ||
+	    (hp->next != NULL && hp->next->prev != hp))
+		harden_fail("corrupt huge block", bp);
+#endif
+	huge_unlink(hp);
+	HUGE_UNLOCK();
+	mem_unmap(hp, GET_SIZE(HDRP(bp)));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a huge block.  "size" is at least
+ *   HUGE_THRESHOLD.
+ *
+ * Effects:
+ *   Resize the mapping of the huge block "bp" to hold "size" bytes of
+ *   payload.  The pages are moved rather than copied if the mapping has to
+ *   move.  Returns the new address of the block if successful and NULL,
+ *   leaving the block untouched, otherwise.
+ */
+static void *
+huge_resize(void *bp, size_t size)
+{
+	size_t oldsize = GET_SIZE(HDRP(bp));
+	size_t msize = HUGE_MAPSIZE(size);
+	struct huge_block *hp = HUGE_BLOCK(bp);
+
+	if (msize == oldsize)
+		return (bp);
+
+	/* The list links move with the pages, so fix up the neighbors. */
+	HUGE_LOCK();
+	huge_unlink(hp);
+	if ((hp = mem_remap(hp, oldsize, msize)) == (void *)-1) {
+		huge_link(HUGE_BLOCK(bp));
+		HUGE_UNLOCK();
+		return (NULL);
+	}
+	huge_link(hp);
+	HUGE_UNLOCK();
+	PUT(HUGE_PAYLOAD(hp) - WSIZE, PACK(msize, HUGE_BITS | 1));
+#if MM_STATS
+	stat_peak();
+#endif
+	return (HUGE_PAYLOAD(hp));
+}
+
+/*
+ * Requires:
+ *   The huge block lock is held.  "hp" is a huge block that is not on the
+ *   list.
+ *
+ * Effects:
+ *   Add "hp" to the list of huge blocks.
+ */
+static void
+huge_link(struct huge_block *hp)
+{
+
+	hp->prev = NULL;
+	hp->next = huge_listp;
+	if (huge_listp != NULL)
+		huge_listp->prev = hp;
+	huge_listp = hp;
+}
+
+/*
+ * Requires:
+ *   The huge block lock is held.  "hp" is a huge block on the list.
+ *
+ * Effects:
+ *   Remove "hp" from the list of huge blocks.
+ */
+static void
+huge_unlink(struct huge_block *hp)
+{
+
+	if (hp->prev != NULL)
+		hp->prev->next = hp->next;
+	else
+		huge_listp = hp->next;
+	if (hp->next != NULL)
+		hp->next->prev = hp->prev;
+}
+
+/* 
+ * The following routines implement the slab tier for small requests.
+ */
+
+/*
+ * Requires:
+ *   "cls" is a slab size class.
+ *
+ * Effects:
+ *   Allocate an object of class "cls" from the slab page at the head of that
+ *   class, creating a new page if the class has none with free objects.
+ *   Returns the address of the object if the allocation was successful and
+ *   NULL otherwise.
+ */
+static void *
+slab_alloc(int cls)
+{
+	struct slab_page *page = arenap->slab_listp[cls];
+	char *objp;
+
+	if (page == NULL && (page = slab_new_page(cls)) == NULL)
+		return (NULL);
+
+	/* Reuse a freed object if there is one, otherwise carve a new one. */
+	if (page->free_objs != NULL) {
+		objp = page->free_objs;
+		page->free_objs = GET_LINK((void **)objp);
+	} else
+		objp = SLAB_OBJP(page, page->ncarved++);
+	page->nlive++;
+
+	/* Retire the page from its list once it is full. */
+	if (page->free_objs == NULL && page->ncarved == SLAB_NOBJS(cls))
+		slab_unlink(page);
+
+	PUT(HDRP(objp), (uintptr_t)page | SLAB_BIT | 0x1);
+	return (objp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated slab object.
+ *
+ * Effects:
+ *   Return the object to its page.  A page that becomes empty is released
+ *   to the segregated lists unless it is the last page of its class.
+ */
+static void
+slab_free(void *bp)
+{
+	struct slab_page *page = (struct slab_page *)GET_SIZE(HDRP(bp));
+
+#if MM_HARDEN
+	if (!GET_ALLOC(HDRP(bp)))
+		harden_fail("double free", bp);
+	if (page->class >= SLAB_NCLASSES || (char *)bp < SLAB_FIRST(page) ||
+	    (char *)bp >= (char *)page + SLAB_PAGESIZE - WSIZE)
+		harden_fail("corrupt header", bp);
+#endif
+	PUT(HDRP(bp), (uintptr_t)page | SLAB_BIT);
+
+	/* A full page has free objects again, so put it back on its list. */
+	if (page->nlive == SLAB_NOBJS(page->class))
+		slab_push(page);
+	SET_LINK((void **)bp, page->free_objs);
+	page->free_objs = bp;
+
+	if (--page->nlive == 0 &&
+	    (page->prev_page != NULL || page->next_page != NULL)) {
+		slab_unlink(page);
+		free_block(page);
+	}
+}
+
+/*
+ * Requires:
+ *   "cls" is a slab size class.
+ *
+ * Effects:
+ *   Carve a new, empty slab page for class "cls" out of a boundary tag block
+ *   and add it to the class's list.  Returns the page if successful and
+ *   NULL otherwise.
+ */
+static struct slab_page *
+slab_new_page(int cls)
+{
+	struct slab_page *page;
+
+	if ((page = alloc_block(SLAB_PAGESIZE - WSIZE)) == NULL)
+		return (NULL);
+	page->free_objs = NULL;
+	page->nlive = 0;
+	page->ncarved = 0;
+	page->class = cls;
+	slab_push(page);
+	return (page);
+}
+
+/*
+ * Requires:
+ *   "page" is a slab page that is not on its class's list.
+ *
+ * Effects:
+ *   Push "page" onto the head of its class's list.
+ */
+static void
+slab_push(struct slab_page *page)
+{
+	struct slab_page **headp = &arenap->slab_listp[page->class];
+
+	page->prev_page = NULL;
+	page->next_page = *headp;
+	if (*headp != NULL)
+		(*headp)->prev_page = page;
+	*headp = page;
+}
+
+/*
+ * Requires:
+ *   "page" is a slab page on its class's list.
+ *
+ * Effects:
+ *   Remove "page" from its class's list.
+ */
+static void
+slab_unlink(struct slab_page *page)
+{
+
+	if (page->prev_page != NULL)
+		page->prev_page->next_page = page->next_page;
+	else
+		arenap->slab_listp[page->class] = page->next_page;
+	if (page->next_page != NULL)
+		page->next_page->prev_page = page->prev_page;
+	page->prev_page = NULL;
+	page->next_page = NULL;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Free every empty slab page of arenap, including the page that
+ *   slab_free keeps for each class.
+ */
+static void
+slab_release(void)
+{
+	struct slab_page *page, *next;
+
+	for (int cls = 0; cls < SLAB_NCLASSES; cls++) {
+		for (page = arenap->slab_listp[cls]; page != NULL; page = next) {
+			next = page->next_page;
+			if (page->nlive == 0) {
+				slab_unlink(page);
+				free_block(page);
+			}
+		}
+	}
+}
+
+#if MM_THREADS
+/* 
+ * The following routines implement the per-thread caches of slab objects.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the calling thread's cache, emptying it first if it was filled
+ *   before the last mm_init, and arranging for it to be flushed when the
+ *   thread exits.
+ */
+static struct tcache *
+tcache_get(void)
+{
+	struct tcache *tc = &tcache;
+
+	if (tc->epoch != heap_epoch) {
+#if MM_STATS
+		/* mm_stats reads the counters and epoch of other threads. */
+		pthread_mutex_lock(&stats_lock);
+		memset(&tc->stats, 0, sizeof(tc->stats));
+#endif
+		memset(tc->bins, 0, sizeof(tc->bins));
+		memset(tc->counts, 0, sizeof(tc->counts));
+		tc->home = NULL;
+		tc->epoch = heap_epoch;
+#if MM_STATS
+		pthread_mutex_unlock(&stats_lock);
+#endif
+	}
+	if (!tc->registered) {
+		pthread_once(&tcache_once, tcache_key_init);
+		pthread_setspecific(tcache_key, tc);
+		tc->registered = true;
+#if MM_STATS
+		pthread_mutex_lock(&stats_lock);
+		tc->prev = NULL;
+		if ((tc->next = tcache_listp) != NULL)
+			tcache_listp->prev = tc;
+		tcache_listp = tc;
+		pthread_mutex_unlock(&stats_lock);
+#endif
+	}
+	return (tc);
+}
+
+/*
+ * Requires:
+ *   "cls" is a slab size class.
+ *
+ * Effects:
+ *   Allocate an object of class "cls" from the calling thread's cache,
+ *   refilling half of the cache from the thread's arena if it is empty.
+ *   Returns the address of the object if the allocation was successful and
+ *   NULL otherwise.
+ */
+static void *
+tcache_alloc(int cls)
+{
+	struct tcache *tc = tcache_get();
+	struct arena *ap;
+	void *bp;
+
+	if (tc->bins[cls] == NULL) {
+		ap = home_arena();
+		LOCK(ap);
+		remote_drain();
+		while (tc->counts[cls] < TCACHE_COUNT / 2 &&
+		    (bp = slab_alloc(cls)) != NULL) {
+			TCACHE_PARK(bp);
+			SET_LINK((void **)bp, tc->bins[cls]);
+			tc->bins[cls] = bp;
+			tc->counts[cls]++;
+		}
+		UNLOCK(ap);
+
+		/* The home arena is full, so look for another one. */
+		if (tc->bins[cls] == NULL)
+			return (arena_alloc(SLAB_SLOT(cls) - WSIZE, 0, NULL));
+	}
+
+	bp = tc->bins[cls];
+	tc->bins[cls] = GET_LINK((void **)bp);
+	tc->counts[cls]--;
+	TCACHE_TAKE(bp);
+	return (bp);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated slab object of at least class
+ *   "cls".
+ *
+ * Effects:
+ *   Put the object in the calling thread's cache of class "cls", first
+ *   returning half of that cache to the heap if it is full.
+ */
+static void
+tcache_free(void *bp, int cls)
+{
+	struct tcache *tc = tcache_get();
+
+#if MM_HARDEN
+	if (!GET_ALLOC(HDRP(bp)))
+		harden_fail("double free", bp);
+#endif
+	if (tc->counts[cls] == TCACHE_COUNT)
+		tcache_flush(tc, cls, TCACHE_COUNT / 2);
+	TCACHE_PARK(bp);
+	SET_LINK((void **)bp, tc->bins[cls]);
+	tc->bins[cls] = bp;
+	tc->counts[cls]++;
+}
+
+/*
+ * Requires:
+ *   "tc" was filled since the last mm_init.
+ *
+ * Effects:
+ *   Return objects of class "cls" from "tc" until at most "keep" are left.
+ *   Objects of the thread's home arena go back to their pages under one
+ *   lock, and the others onto their arenas' stacks of remote frees.
+ */
+static void
+tcache_flush(struct tcache *tc, int cls, unsigned int keep)
+{
+	struct arena *home = home_arena();
+	bool locked = false;
+	void *bp;
+
+	while (tc->counts[cls] > keep) {
+		bp = tc->bins[cls];
+		tc->bins[cls] = GET_LINK((void **)bp);
+		tc->counts[cls]--;
+		TCACHE_TAKE(bp);
+		if (arena_of(bp) != home) {
+			remote_push(arena_of(bp), bp);
+			continue;
+		}
+		if (!locked) {
+			LOCK(home);
+			locked = true;
+		}
+		slab_free(bp);
+	}
+	if (locked)
+		UNLOCK(home);
+}
+
+/*
+ * Requires:
+ *   "arg" is the cache of a thread that is exiting.
+ *
+ * Effects:
+ *   Return every object in the cache to the heap, unless the heap has been
+ *   reinitialized since the cache was filled.
+ */
+static void
+tcache_destroy(void *arg)
+{
+	struct tcache *tc = arg;
+
+	if (tc->epoch == heap_epoch) {
+		for (int cls = 0; cls < SLAB_NCLASSES; cls++)
+			tcache_flush(tc, cls, 0);
+	}
+#if MM_STATS
+	/* Leave the counters behind before the cache goes away. */
+	pthread_mutex_lock(&stats_lock);
+	if (tc->epoch == heap_epoch)
+		stats_sum(&stats_exited, &tc->stats);
+	if (tc->prev != NULL)
+		tc->prev->next = tc->next;
+	else
+		tcache_listp = tc->next;
+	if (tc->next != NULL)
+		tc->next->prev = tc->prev;
+	pthread_mutex_unlock(&stats_lock);
+#endif
+	tc->registered = false;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Create the key whose destructor flushes a thread's cache at exit.
+ */
+static void
+tcache_key_init(void)
+{
+
+	pthread_key_create(&tcache_key, tcache_destroy);
+}
+#endif
+
+#if MM_STATS
+/* 
+ * The following routines keep the statistics of MM_STATS.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the counters of the calling thread.
+ */
+static struct mm_stats *
+stats_get(void)
+{
+
+#if MM_THREADS
+	return (&tcache_get()->stats);
+#else
+	return (&stats);
+#endif
+}
+
+/*
+ * Requires:
+ *   "ctr" is a counter of the calling thread.
+ *
+ * Effects:
+ *   Add "n" to the counter "*ctr".  Only the calling thread writes it, but
+ *   mm_stats may read it from another thread at any time.
+ */
+static void
+stat_add(size_t *ctr, size_t n)
+{
+
+#if MM_THREADS
+	__atomic_store_n(ctr, __atomic_load_n(ctr, __ATOMIC_RELAXED) + n,
+	    __ATOMIC_RELAXED);
+#else
+	*ctr += n;
+#endif
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Raise the peak heap size to the current heap size if that is larger.
+ */
+static void
+stat_peak(void)
+{
+	size_t size = mem_heapsize();
+	size_t peak = __atomic_load_n(&stats_peak, __ATOMIC_RELAXED);
+
+	while (size > peak && !__atomic_compare_exchange_n(&stats_peak, &peak,
+	    size, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * Requires:
+ *   "dst" and "src" are sets of counters.
+ *
+ * Effects:
+ *   Add every counter of "src" to the same counter of "dst".
+ */
+static void
+stats_sum(struct mm_stats *dst, struct mm_stats *src)
+{
+	size_t *dp = (size_t *)dst, *sp = (size_t *)src;
+
+	/* Every member of struct mm_stats is a size_t. */
+	for (size_t i = 0; i < sizeof(*dst) / sizeof(size_t); i++)
+		dp[i] += __atomic_load_n(&sp[i], __ATOMIC_RELAXED);
+}
+#endif
+
+/* 
+ * The following routines implement the splay tree that holds the free blocks
+ * of the last size class.
+ */
+
+/*
+ * Requires:
+ *   "np" is the root of a tree or NULL.
+ *
+ * Effects:
+ *   Top-down splay of the key (size, addr) in the tree rooted at "np".
+ *   Returns the new root, which is the node with that key if there is one,
+ *   and otherwise its predecessor or successor.
+ */
+static struct block_list *
+tree_splay(struct block_list *np, size_t size, void *addr)
+{
+	struct block_list head, *l, *r, *y;
+
+	if (np == NULL)
+		return (NULL);
+
+	/* l and r are the rightmost node of the left tree and vice versa. */
+	SET_LEFT(&head, NULL);
+	SET_RIGHT(&head, NULL);
+	l = r = &head;
+	for (;;) {
+		if (KEY_LT(size, addr, np)) {
+			if (LEFT(np) == NULL)
+				break;
+			if (KEY_LT(size, addr, LEFT(np))) {
+				/* Rotate right */
+				y = LEFT(np);
+				SET_LEFT(np, RIGHT(y));
+				SET_RIGHT(y, np);
+				np = y;
+				if (LEFT(np) == NULL)
+					break;
+			}
+			/* Link right */
+			SET_LEFT(r, np);
+			r = np;
+			np = LEFT(np);
+		} else if (np != addr) {
+			if (RIGHT(np) == NULL)
+				break;
+			if (!KEY_LT(size, addr, RIGHT(np)) && RIGHT(np) != addr) {
+				/* Rotate left */
+				y = RIGHT(np);
+				SET_RIGHT(np, LEFT(y));
+				SET_LEFT(y, np);
+				np = y;
+				if (RIGHT(np) == NULL)
+					break;
+			}
+			/* Link left */
+			SET_RIGHT(l, np);
+			l = np;
+			np = RIGHT(np);
+		} else
+			break;
+	}
+
+	/* Reassemble the left, middle and right trees. */
+	SET_RIGHT(l, LEFT(np));
+	SET_LEFT(r, RIGHT(np));
+	SET_LEFT(np, RIGHT(&head));
+	SET_RIGHT(np, LEFT(&head));
+	return (np);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a free block of the last size class that is not
+ *   in the tree.
+ *
+ * Effects:
+ *   Insert "bp" into the tree and make it the root.
+ */
+static void
+tree_insert(struct block_list *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	struct block_list *root;
+
+	root = tree_splay(arenap->free_list_segregatedp[TREE_INDEX], size, bp);
+	if (root == NULL) {
+		SET_LEFT(bp, NULL);
+		SET_RIGHT(bp, NULL);
+	} else if (KEY_LT(size, bp, root)) {
+		SET_LEFT(bp, LEFT(root));
+		SET_RIGHT(bp, root);
+		SET_LEFT(root, NULL);
+	} else {
+		SET_RIGHT(bp, RIGHT(root));
+		SET_LEFT(bp, root);
+		SET_RIGHT(root, NULL);
+	}
+	arenap->free_list_segregatedp[TREE_INDEX] = bp;
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block in the tree.
+ *
+ * Effects:
+ *   Remove "bp" from the tree.
+ */
+static void
+tree_remove(struct block_list *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	struct block_list *root;
+
+	/* Splay bp to the root, then join its subtrees. */
+	root = tree_splay(arenap->free_list_segregatedp[TREE_INDEX], size, bp);
+	if (LEFT(root) == NULL) {
+		root = RIGHT(root);
+	} else {
+		/* Every key on the left is smaller, so its maximum comes up. */
+		struct block_list *right = RIGHT(root);
+		root = tree_splay(LEFT(root), size, bp);
+		SET_RIGHT(root, right);
+	}
+	arenap->free_list_segregatedp[TREE_INDEX] = root;
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns the smallest block in the tree with at least "asize" bytes,
+ *   preferring the lowest address among equal sizes, or NULL if there is
+ *   none.  The tree is left splayed around that block.
+ */
+static struct block_list *
+tree_bestfit(size_t asize)
+{
+	struct block_list *root;
+
+	/* No block has a lower address than NULL, so this lands next to it. */
+	root = tree_splay(arenap->free_list_segregatedp[TREE_INDEX], asize,
+	    NULL);
+	if (root != NULL && GET_SIZE(HDRP(root)) < asize && RIGHT(root) != NULL)
+		SET_RIGHT(root, tree_splay(RIGHT(root), asize, NULL));
+	arenap->free_list_segregatedp[TREE_INDEX] = root;
+
+	/* The root is the predecessor or successor, its right child the latter. */
+	if (root == NULL || GET_SIZE(HDRP(root)) >= asize)
+		return (root);
+	return (RIGHT(root));
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block.
+ *
+ * Effects:
+ *   Returns true if the search for "bp" from the root of the tree ends
+ *   without it in at most CHECK_DEPTH steps, so that "bp" is certainly not
+ *   in the tree.  A deeper search gives up and returns false, which keeps
+ *   the cost constant in a deep tree.  Does not change the tree's shape.
+ */
+static bool
+tree_missing(struct block_list *bp)
+{
+	size_t size = GET_SIZE(HDRP(bp));
+	struct block_list *np = arenap->free_list_segregatedp[TREE_INDEX];
+
+	for (int depth = 0; depth < CHECK_DEPTH; depth++) {
+		if (np == bp)
+			return (false);
+		if (np == NULL)
+			return (true);
+		np = KEY_LT(size, bp, np) ? LEFT(np) : RIGHT(np);
+	}
+	return (false);
 }
 
+#if MM_HARDEN || MM_CANARY
+/* 
+ * The following routines implement the integrity checks of MM_HARDEN and
+ * MM_CANARY.  Each takes constant time.
+ */
+
 /*
  * Requires:
- *   Size of the block we are looking for.
+ *   None.
  *
  * Effects:
- *   Find a fit for a block with "asize" bytes.  Returns that block's address
- *   or NULL if no suitable block was found. 
+ *   Report the corruption "what" found at "bp" and abort.
  */
-static void *
-find_fit(size_t asize)
+static void
+harden_fail(const char *what, void *bp)
 {
-	if (asize % WSIZE != 0)
-		printf("Error: you did something wrong");
 
-	/* Get the right free list head */
-	int index = freelistindex(asize);
-	struct block_list *freep = free_list_segregatedp[index];
+	fprintf(stderr, "mm: %s at %p\n", what, bp);
+	abort();
+}
+#endif
 
-	/* Iterate through free list looking for free block */
-	while (freep != NULL) {
-		if (GET_SIZE(HDRP(freep)) >= asize) {
-			if (freep->prev_list != NULL && freep->next_list != NULL) {
-				freep->prev_list->next_list = freep->next_list;
-				freep->next_list->prev_list = freep->prev_list;
-			} else if (freep->prev_list != NULL) {
-				freep->prev_list->next_list = NULL;
-			} else if (freep->next_list != NULL) {
-				freep->next_list->prev_list = NULL;
-				free_list_segregatedp[index] = freep->next_list;
-			} else {
-				free_list_segregatedp[index] = NULL;
-			}
-			return freep;
-		} else {
-			freep = freep->next_list;
-		}
+#if MM_HARDEN
+/*
+ * Requires:
+ *   "bp" is the address of a boundary tag block of arenap that is about to
+ *   be freed.
+ *
+ * Effects:
+ *   Abort unless "bp" is allocated, lies within the heap, and its header
+ *   agrees with the PREV_ALLOC bit of the next block and with the footers
+ *   of free neighbors.
+ */
+static void
+harden_block(void *bp)
+{
+	uintptr_t hdr = GET(HDRP(bp));
+	size_t size = hdr & ~(DSIZE - 1), psize;
+	char *nextp = (char *)bp + size;
+	char *brk = mem_sbrk_arena(arenap->index, 0);
+
+	if (!(hdr & 0x1))
+		harden_fail("double free", bp);
+	if ((hdr & SLAB_BIT) || size < 2 * DSIZE ||
+	    (char *)bp <= arenap->heap_listp || nextp > brk ||
+	    !GET_PREV_ALLOC(HDRP(nextp)))
+		harden_fail("corrupt header", bp);
+
+	/* A free next block's footer must match its header. */
+	if (!GET_ALLOC(HDRP(nextp)) && (nextp + GET_SIZE(HDRP(nextp)) > brk ||
+	    GET(FTRP(nextp)) != PACK(GET_SIZE(HDRP(nextp)), 0)))
+		harden_fail("corrupt footer", nextp);
+
+	/* So must a free previous block's. */
+	if (!(hdr & PREV_ALLOC)) {
+		psize = GET_SIZE((char *)bp - DSIZE);
+		if (psize < 2 * DSIZE ||
+		    psize > (size_t)((char *)bp - arenap->heap_listp) ||
+		    (GET(HDRP(PREV_BLKP(bp))) & ~(uintptr_t)PREV_ALLOC) !=
+		    GET((char *)bp - DSIZE))
+			harden_fail("corrupt footer", bp);
 	}
+}
 
-	/* Now Check the 4 higher indices of free blocks */
-	if (index == 11) {
-		return NULL; 	 // Error handle index out of bounds.
-	}
-	index += 1;
-	int max = index + 4; // After testing, 4 gives best results.
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns true if the free list link "np" is NULL or an aligned address
+ *   within the heap of arenap, so that it can be followed.
+ */
+static bool
+harden_link(void *np)
+{
 
-	/* 
-	 * If we go to the next free list, the head is guaranteed to be enough 
-	 * size, so we only have to check the head 
-	 */
-	while (index <= max && index <= 11) {
-		freep = free_list_segregatedp[index];
-		if (freep != NULL) {
-			if (freep->next_list != NULL) {
-				freep->next_list->prev_list = NULL;
-				free_list_segregatedp[index] = freep->next_list;
-			} else {
-				free_list_segregatedp[index] = NULL;
-			}
-			return freep;
-		}
-		index++;
-	}	
+	return (np == NULL || ((uintptr_t)np % DSIZE == 0 &&
+	    (char *)np > arenap->heap_listp &&
+	    (char *)np < (char *)mem_sbrk_arena(arenap->index, 0)));
+}
+#endif
+
+#if MM_CANARY
+/*
+ * Requires:
+ *   "bp" is either NULL or the address of an allocated block.
+ *
+ * Effects:
+ *   Write the canary of "bp" into the last word of its payload.  Returns
+ *   "bp".
+ */
+static void *
+canary_set(void *bp)
+{
 
-	/* No free blocks were found */
-	return NULL;
+	if (bp != NULL)
+		PUT(CANARYP(bp), CANARY(bp));
+	return (bp);
 }
 
-/* 
+/*
  * Requires:
- *   "bp" is the address of a free block that is at least "asize" bytes.
+ *   "bp" is the address of a block.
  *
  * Effects:
- *   Place a block of "asize" bytes at the start of the free block "bp" and
- *   split that block if the remainder would be at least the minimum block
- *   size. 
+ *   Abort if "bp" is allocated and its canary has been overwritten.  A
+ *   block that is already free is left to MM_HARDEN's checks.
  */
 static void
-place(void *bp, size_t asize)
+canary_check(void *bp)
 {
-	size_t csize = GET_SIZE(HDRP(bp));   
 
-	if ((csize - asize) >= (2 * DSIZE)) { 
-		/* Case where we can split some excess memory off and reuse it */
-		PUT(HDRP(bp), PACK(asize, 1));
-		PUT(FTRP(bp), PACK(asize, 1));
+	if ((GET_OWN(HDRP(bp)) & 0x1) && GET(CANARYP(bp)) != CANARY(bp))
+		harden_fail("tail canary overwritten", bp);
+}
 
-		bp = NEXT_BLKP(bp);
-		PUT(HDRP(bp), PACK(csize - asize, 0));
-		PUT(FTRP(bp), PACK(csize - asize, 0));
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Returns "x" mixed by the finalizer of SplitMix64, so that every bit of
+ *   the result depends on every bit of "x".
+ */
+static uintptr_t
+canary_hash(uintptr_t x)
+{
 
-		/* Add the excess memory to free list */
-		int index = freelistindex((csize - asize));
-		add_to_free(bp,index);
-	} else {
-		/* Can't cut any excess memory off the allocated block */
-		PUT(HDRP(bp), PACK(csize, 1));
-		PUT(FTRP(bp), PACK(csize, 1));
-	}
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+	return (x ^ (x >> 31));
+}
+
+/*
+ * Requires:
+ *   "bp" is either NULL or the address of an allocated block that holds
+ *   the payload of a block of "oldusable" bytes, canary included.
+ *
+ * Effects:
+ *   Clear the old canary if the block grew, so that it does not linger in
+ *   the payload, and write the new one.  Returns "bp".
+ */
+static void *
+canary_resize(void *bp, size_t oldusable)
+{
+
+	if (bp != NULL && block_usable(bp) > oldusable)
+		PUT((char *)bp + oldusable - WSIZE, 0);
+	return (canary_set(bp));
 }
+#endif
 
 /* 
  * The remaining routines are heap consistency checker routines. 
  */
 
+/* 
+ * The following routines write heap snapshots.
+ */
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Write the struct mm_snap_arena and block words of arenap to "fp".
+ *   Returns 0 if successful and -1 if writing failed.
+ */
+static int
+snap_arena(FILE *fp)
+{
+	struct mm_snap_arena hdr;
+	uint64_t word;
+	char *bp, *first = NEXT_BLKP(arenap->heap_listp);
+#if MM_DEFER
+	/* The quick lists hold at most QUICK_LIMIT bytes of minimum blocks. */
+	void *quick[QUICK_LIMIT / (2 * DSIZE)];
+	int nquick = 0, q = 0;
+
+	for (int i = 0; i < NQUICK; i++) {
+		for (bp = arenap->quick_listp[i]; bp != NULL;
+		    bp = GET_LINK((void **)bp))
+			quick[nquick++] = bp;
+	}
+	qsort(quick, nquick, sizeof(void *), ptr_cmp);
+#endif
+
+	hdr.start = (uintptr_t)first;
+	hdr.nblocks = 0;
+	for (bp = first; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp))
+		hdr.nblocks++;
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		return (-1);
+
+	for (bp = first; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
+		word = GET_SIZE(HDRP(bp));
+		if (!GET_ALLOC(HDRP(bp)))
+			word |= (uint64_t)freelistindex(word) << 56;
+#if MM_DEFER
+		else if (q < nquick && quick[q] == bp) {
+			word |= MM_SNAP_QUICK |
+			    (uint64_t)QUICK_INDEX(GET_SIZE(HDRP(bp))) << 56;
+			q++;
+		}
+#endif
+		else {
+			word |= MM_SNAP_ALLOC;
+			if (snap_is_slab(bp))
+				word |= MM_SNAP_SLAB;
+		}
+		if (fwrite(&word, sizeof(word), 1, fp) != 1)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of an allocated block.
+ *
+ * Effects:
+ *   Returns whether "bp" is a slab page, i.e., a block of SLAB_PAGESIZE
+ *   bytes whose first object's header, allocated or not, points back at
+ *   it.  An object is
+ *   carved as soon as its page is made, so only a page that is just being
+ *   set up is missed.
+ */
+static bool
+snap_is_slab(void *bp)
+{
+	uintptr_t hdr;
+
+	if (GET_SIZE(HDRP(bp)) != SLAB_PAGESIZE)
+		return (false);
+	hdr = GET(HDRP(SLAB_OBJP((struct slab_page *)bp, 0)));
+	return ((hdr & ~(uintptr_t)0x1) == ((uintptr_t)bp | SLAB_BIT));
+}
+
+#if MM_DEFER
+/*
+ * Requires:
+ *   "a" and "b" point to block addresses.
+ *
+ * Effects:
+ *   Compare the block addresses for qsort.
+ */
+static int
+ptr_cmp(const void *a, const void *b)
+{
+	uintptr_t x = (uintptr_t)*(void *const *)a;
+	uintptr_t y = (uintptr_t)*(void *const *)b;
+
+	return ((x > y) - (x < y));
+}
+#endif
+
 /*
  * Requires:
  *   "bp" is the address of a block.
  *
  * Effects:
- *   Perform a minimal check on the block "bp".
+ *   Perform a minimal check on the block "bp" and its links in constant
+ *   time.  A block in the tree is checked against its children and
+ *   looked up at most CHECK_DEPTH levels down from the root, since the
+ *   tree is not splayed here and may be deep.  Whether the free lists and
+ *   the tree hold exactly the free blocks is left to the end of the pass.
  */
 static void
 checkblock(void *bp) 
 {
+	struct block_list *np = bp, *prevp, *nextp;
+	bool alloc = GET_ALLOC(HDRP(bp));
+
 	/* check alignment of header */
 	if ((uintptr_t)bp % DSIZE)
-		printf("Error: %p is not doubleword aligned\n", bp);
-	if (GET(HDRP(bp)) != GET(FTRP(bp)))
-		printf("Error: header does not match footer\n");
+		check_fail("%p is not doubleword aligned\n", bp);
+	if (!alloc &&
+	    (GET_SIZE(HDRP(bp)) != GET_SIZE(FTRP(bp)) || GET_ALLOC(FTRP(bp))))
+		check_fail("%p header does not match footer\n", bp);
+	if (!alloc && !GET_PREV_ALLOC(HDRP(bp)))
+		check_fail("%p and the block before it are both free\n", bp);
+	if (!GET_PREV_ALLOC(HDRP(NEXT_BLKP(bp))) != !alloc)
+		check_fail("%p has a stale previous allocated bit\n",
+		    NEXT_BLKP(bp));
+	if (alloc)
+		return;
 
 	int index = freelistindex(GET_SIZE(HDRP(bp)));
-	struct block_list *i = free_list_segregatedp[index];
-	if (!GET_ALLOC(HDRP(bp))) {
-		/* Check if free blocks are in the correct free list */
-		while (i != NULL) {
-			if (i == bp) {
-				printf("Found %p in free list index %u\n", bp, index);
-				return;
-			}
-			i = i->next_list;
-		}
-		printf("Error: %p not in free list at index %u with size %zu \n", bp,
-			index, GET_SIZE(HDRP(bp)));
-	} else {
-		/* Check that non free blocks aren't in any free lists */
-		while (i != NULL) {
-			if (i == bp) {
-				printf("Found %p when I wasn't supposed to", bp);
-				return;
-			}
-			if (i == NULL || i->next_list == NULL) {
-				break;
-			}
-			i = i->next_list;
+	if (IS_TREE(index)) {
+		if (tree_missing(np))
+			check_fail("%p with size %zu is not in the tree\n", bp,
+			    GET_SIZE(HDRP(bp)));
+
+		/* Its children must be free tree blocks on the right sides. */
+		prevp = LEFT(np);
+		nextp = RIGHT(np);
+		if (prevp != NULL && (GET_ALLOC(HDRP(prevp)) ||
+		    freelistindex(GET_SIZE(HDRP(prevp))) != TREE_INDEX ||
+		    !KEY_LT(GET_SIZE(HDRP(prevp)), prevp, np)))
+			check_fail("%p in the tree has left child %p\n", bp,
+			    prevp);
+		if (nextp != NULL && (GET_ALLOC(HDRP(nextp)) ||
+		    freelistindex(GET_SIZE(HDRP(nextp))) != TREE_INDEX ||
+		    KEY_LT(GET_SIZE(HDRP(nextp)), nextp, np)))
+			check_fail("%p in the tree has right child %p\n", bp,
+			    nextp);
+		return;
+	}
+
+	/* Its neighbors on the list must point back at it. */
+	prevp = PREV_FREE(np);
+	nextp = NEXT_FREE(np);
+	if ((prevp == NULL ? arenap->free_list_segregatedp[index] :
+	    NEXT_FREE(prevp)) != np)
+		check_fail("%p not in free list at index %d with size %zu\n",
+		    bp, index, GET_SIZE(HDRP(bp)));
+	if (nextp != NULL && (GET_ALLOC(HDRP(nextp)) ||
+	    freelistindex(GET_SIZE(HDRP(nextp))) != index ||
+	    PREV_FREE(nextp) != np))
+		check_fail("%p in free list index %d links to %p\n", bp, index,
+		    nextp);
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check the blocks of arenap's heap from the checker's cursor on, at
+ *   most "*budgetp" of them, and take the number checked off "*budgetp".
+ *   A pass starts at the prologue.  At the epilogue, the sum of the hashes
+ *   of the free blocks seen in each class must equal the arena's, and
+ *   their bytes its free bytes, which checks in linear time that the free
+ *   lists hold exactly the free blocks.  Returns true if the pass ended.
+ */
+static bool
+check_walk(size_t *budgetp)
+{
+	struct arena *ap = arenap;
+	char *bp;
+
+	if (ap->check_curp == NULL) {
+		/* Check prologue */
+		if (GET_SIZE(HDRP(ap->heap_listp)) != DSIZE ||
+		    !GET_ALLOC(HDRP(ap->heap_listp)))
+			check_fail("bad prologue header\n");
+		memset(ap->check_hash, 0, sizeof(ap->check_hash));
+		ap->check_bytes = 0;
+		ap->check_curp = ap->heap_listp;
+	}
+	for (bp = ap->check_curp; GET_SIZE(HDRP(bp)) > 0 && *budgetp > 0;
+	    bp = NEXT_BLKP(bp)) {
+		checkblock(bp);
+		if (!GET_ALLOC(HDRP(bp))) {
+			ap->check_hash[freelistindex(GET_SIZE(HDRP(bp))) >>
+			    SL_SHIFT] += CHECK_HASH(bp);
+			ap->check_bytes += GET_SIZE(HDRP(bp));
 		}
+		(*budgetp)--;
+	}
+	ap->check_curp = bp;
+	if (GET_SIZE(HDRP(bp)) > 0)
+		return (false);
+
+	/* Check epilogue */
+	if (!GET_ALLOC(HDRP(bp)))
+		check_fail("bad epilogue header\n");
+	for (int i = 0; i < NCLASSES; i++) {
+		if (ap->check_hash[i] != ap->free_hash[i])
+			check_fail("free lists of class %d do not hold its free "
+			    "blocks\n", i);
 	}
+	if (ap->check_bytes != ap->free_bytes)
+		check_fail("%zu free bytes counted as %zu\n", ap->check_bytes,
+		    ap->free_bytes);
+	ap->check_curp = NULL;
+	return (true);
+}
+
+/*
+ * Requires:
+ *   "bp" is the address of a block that may have just absorbed the blocks
+ *   after it.
+ *
+ * Effects:
+ *   Move the checker's cursor back to "bp" if it was on one of the blocks
+ *   that "bp" absorbed, so that it stays on the start of a block.
+ */
+static void
+check_merged(void *bp)
+{
+	char *curp = arenap->check_curp;
+
+	if (curp > (char *)bp && curp < (char *)bp + GET_SIZE(HDRP(bp)))
+		arenap->check_curp = bp;
+}
+
+/*
+ * Requires:
+ *   "fmt" is a printf format for the arguments that follow.
+ *
+ * Effects:
+ *   Print an error found by the checker and count it in arenap.
+ */
+static void
+check_fail(const char *fmt, ...)
+{
+	va_list args;
+
+	arenap->check_errors++;
+	printf("Error: ");
+	va_start(args, fmt);
+	vprintf(fmt, args);
+	va_end(args);
 }
 
 /* 
@@ -490,32 +3471,34 @@ checkblock(void *bp)
 void
 checkheap(bool verbose) 
 {
+	size_t budget = SIZE_MAX;
 	void *bp;
 
 	if (verbose) {
 		printf("\n------------------ New Checkheap Call");
 		printf("----------------------\n");
-		printf("Heap (%p):\n", heap_listp);
-	}
-
-	/* Check prologue */
-	if (GET_SIZE(HDRP(heap_listp)) != DSIZE ||
-	    !GET_ALLOC(HDRP(heap_listp)))
-		printf("Bad prologue header\n");
-	checkblock(heap_listp);
-
-	for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_BLKP(bp)) {
-		if (verbose)
+		printf("Heap (%p):\n", arenap->heap_listp);
+		for (bp = arenap->heap_listp; GET_SIZE(HDRP(bp)) > 0;
+		    bp = NEXT_BLKP(bp))
 			printblock(bp);
-		checkblock(bp);
+		printblock(bp);
 	}
 
+	/* Check every block in one pass. */
+	arenap->check_curp = NULL;
+	check_walk(&budget);
+
 	/* Print entire free list */
+	if (IS_TREE(TREE_INDEX))
+		checktree(arenap->free_list_segregatedp[TREE_INDEX], verbose);
 	if (verbose) {
-		for (int i = 0; i < 12; i++) {
-			for (struct block_list *head = free_list_segregatedp[i]; head != 
-				NULL; head = head->next_list) {
-				if (head == head->next_list) {
+		for (int i = 0; i < NLISTS; i++) {
+			if (IS_TREE(i))
+				continue;
+			for (struct block_list *head =
+				arenap->free_list_segregatedp[i]; head != NULL;
+				head = NEXT_FREE(head)) {
+				if (head == NEXT_FREE(head)) {
 					printf("Screwed up here on %p", head);
 					return;
 				}
@@ -526,11 +3509,98 @@ checkheap(bool verbose)
 		}
 	}
 
-	/* Check epilogue */
+	checkslabs();
+#if MM_DEFER
+	checkquick();
+#endif
+}
+
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check that every page on a slab list belongs to that list's class, has
+ *   free objects, and lives in an allocated block.
+ */
+static void
+checkslabs(void)
+{
+	struct slab_page *page;
+
+	for (int i = 0; i < SLAB_NCLASSES; i++) {
+		for (page = arenap->slab_listp[i]; page != NULL;
+		    page = page->next_page) {
+			if (page->class != (uint32_t)i)
+				printf("Error: slab page %p of class %u in list %d\n",
+				    page, page->class, i);
+			if (page->nlive == SLAB_NOBJS(i))
+				printf("Error: full slab page %p in list %d\n",
+				    page, i);
+			if (!GET_ALLOC(HDRP(page)))
+				printf("Error: slab page %p is a free block\n", page);
+		}
+	}
+}
+
+#if MM_DEFER
+/*
+ * Requires:
+ *   None.
+ *
+ * Effects:
+ *   Check that every block on a quick list is marked allocated and has the
+ *   list's size, and that the lists hold quick_bytes bytes.
+ */
+static void
+checkquick(void)
+{
+	size_t bytes = 0;
+
+	for (int q = 0; q < NQUICK; q++) {
+		for (void *bp = arenap->quick_listp[q]; bp != NULL;
+		    bp = GET_LINK((void **)bp)) {
+			if (!GET_ALLOC(HDRP(bp)) || QUICK_INDEX(GET_SIZE(HDRP(bp))) !=
+			    (size_t)q)
+				printf("Error: %p is on the wrong quick list %d\n", bp, q);
+			bytes += GET_SIZE(HDRP(bp));
+		}
+	}
+	if (bytes != arenap->quick_bytes)
+		printf("Error: quick lists hold %zu bytes, not %zu\n", bytes,
+		    arenap->quick_bytes);
+}
+#endif
+
+/*
+ * Requires:
+ *   "np" is a node of the tree or NULL.
+ *
+ * Effects:
+ *   Check that every block in the subtree "np" is free, belongs to the last
+ *   size class, and is ordered with respect to its children.  Prints the
+ *   blocks in order if "verbose" is true.
+ */
+static void
+checktree(struct block_list *np, bool verbose)
+{
+
+	if (np == NULL)
+		return;
+	checktree(LEFT(np), verbose);
+	if (GET_ALLOC(HDRP(np)))
+		printf("Error: allocated block %p in the tree\n", np);
+	if (freelistindex(GET_SIZE(HDRP(np))) != TREE_INDEX)
+		printf("Error: block %p of size %zu in the tree\n", np,
+		    GET_SIZE(HDRP(np)));
+	if (LEFT(np) != NULL && !KEY_LT(GET_SIZE(HDRP(LEFT(np))), LEFT(np), np))
+		printf("Error: tree out of order at %p\n", np);
+	if (RIGHT(np) != NULL && KEY_LT(GET_SIZE(HDRP(RIGHT(np))), RIGHT(np), np))
+		printf("Error: tree out of order at %p\n", np);
 	if (verbose)
-		printblock(bp);
-	if (GET_SIZE(HDRP(bp)) != 0 || !GET_ALLOC(HDRP(bp)))
-		printf("Bad epilogue header\n");
+		printf("Block %p in the tree of size %zu\n", np,
+		    GET_SIZE(HDRP(np)));
+	checktree(RIGHT(np), verbose);
 }
 
 /*
@@ -544,21 +3614,29 @@ static void
 printblock(void *bp) 
 {
 	size_t hsize, fsize;
-	bool halloc, falloc;
+	bool halloc, falloc, palloc;
 
 	checkheap(false);
 	hsize = GET_SIZE(HDRP(bp));
 	halloc = GET_ALLOC(HDRP(bp));  
-	fsize = GET_SIZE(FTRP(bp));
-	falloc = GET_ALLOC(FTRP(bp));  
+	palloc = GET_PREV_ALLOC(HDRP(bp));
 
 	if (hsize == 0) {
 		printf("%p: end of heap\n", bp);
 		return;
 	}
 
-	printf("%p: header: [%zu:%c] footer: [%zu:%c]\n", bp, 
-	    hsize, (halloc ? 'a' : 'f'), 
+	/* Allocated blocks have no footer. */
+	if (halloc) {
+		printf("%p: header: [%zu:a:%c]\n", bp, hsize,
+		    (palloc ? 'a' : 'f'));
+		return;
+	}
+	fsize = GET_SIZE(FTRP(bp));
+	falloc = GET_ALLOC(FTRP(bp));  
+
+	printf("%p: header: [%zu:f:%c] footer: [%zu:%c]\n", bp, 
+	    hsize, (palloc ? 'a' : 'f'), 
 	    fsize, (falloc ? 'a' : 'f'));
 }
 
@@ -580,17 +3658,31 @@ add_to_free(void *bp, int index) {
 
 	struct block_list *add_block = (struct block_list*) bp;
 
-	/* 
-	 * Make sure the neighbors of the block point to the right blocks after 
-	 * removal of bp.
-	 */
-	add_block->prev_list = NULL;
-	add_block->next_list = free_list_segregatedp[index] != NULL ? 
-		free_list_segregatedp[index] : NULL;
-	if (free_list_segregatedp[index] != NULL) {
-		free_list_segregatedp[index]->prev_list = add_block;
+	arenap->free_bytes += GET_SIZE(HDRP(bp));
+	arenap->free_hash[index >> SL_SHIFT] += CHECK_HASH(bp);
+	if ((uintptr_t)bp < (uintptr_t)arenap->check_curp) {
+		/* The checker's pass is past bp, so count bp as checked. */
+		arenap->check_hash[index >> SL_SHIFT] += CHECK_HASH(bp);
+		arenap->check_bytes += GET_SIZE(HDRP(bp));
+	}
+
+	if (IS_TREE(index)) {
+		/* The largest blocks go in the tree instead. */
+		tree_insert(add_block);
+	} else {
+		/* 
+		 * Make sure the neighbors of the block point to the right blocks
+		 * after removal of bp.
+		 */
+		SET_PREV_FREE(add_block, NULL);
+		SET_NEXT_FREE(add_block, arenap->free_list_segregatedp[index]);
+		if (arenap->free_list_segregatedp[index] != NULL) {
+			SET_PREV_FREE(arenap->free_list_segregatedp[index], add_block);
+		}
+		arenap->free_list_segregatedp[index] = add_block;
 	}
-	free_list_segregatedp[index] = add_block;
+	arenap->sl_bitmapp[index >> SL_SHIFT] |= 1u << (index & (SL_COUNT - 1));
+	arenap->fl_bitmap |= 1u << (index >> SL_SHIFT);
 }
 
 
@@ -604,32 +3696,49 @@ add_to_free(void *bp, int index) {
  *   "size" bytes.
  */
 static int freelistindex(size_t size) {
-	/* Bit Shifting operations align our free list chunks by powers of two */
-    if (size <= 1 << 5) {
-        return 0;
-    } else if (size <= 1 << 6) {
-        return 1;
-    } else if (size <= 1 << 7) {
-        return 2;
-    } else if (size <= 1 << 8) {
-        return 3;
-    } else if (size <= 1 << 9) {
-        return 4;
-    } else if (size <= 1 << 10) {
-        return 5;
-    } else if (size <= 1 << 12) {
-        return 6;
-    } else if (size <= 1 << 13) {
-        return 7;
-    } else if (size <= 1 << 14) {
-        return 8;
-    } else if (size <= 1 << 15) {
-        return 9;
-    } else if (size <= 1 << 16) {
-        return 10;
-    } else {
-        return 11;
-    }
+	/*
+	 * Class i holds blocks of (2^(i+4), 2^(i+5)] bytes, so the class is
+	 * ceil(log2(size)) - 5, clamped to the first and last class.
+	 */
+	int fl = (int)(8 * sizeof(size_t)) - __builtin_clzl(size - 1) - 5;
+	fl = MIN(MAX(fl, 0), NCLASSES - 1);
+
+	/*
+	 * The next SL_SHIFT bits below the leading one of size - 1 pick the
+	 * linear sub-class.  The last class is open-ended, so its last
+	 * sub-class takes every size past the class's top.
+	 */
+	size_t sl = MIN((size - 1) >> (fl + 4 - SL_SHIFT), 2 * SL_COUNT - 1);
+
+	return ((fl << SL_SHIFT) | (int)(sl & (SL_COUNT - 1)));
+}
+
+/*
+ * Requires:
+ *   "index" is the index of a free list.
+ *
+ * Effects:
+ *   Returns the index of the first non-empty free list after "index", or
+ *   -1 if there is none.
+ */
+static int
+next_nonempty(int index)
+{
+	int fl = index >> SL_SHIFT;
+	int sl = index & (SL_COUNT - 1);
+	unsigned int map;
+
+	/* First look for a larger sub-class of the same class. */
+	map = arenap->sl_bitmapp[fl] & (~0u << sl << 1);
+	if (map != 0)
+		return ((fl << SL_SHIFT) | __builtin_ctz(map));
+
+	/* Otherwise take the smallest sub-class of the next non-empty class. */
+	map = arenap->fl_bitmap & (~0u << (fl + 1));
+	if (map == 0)
+		return (-1);
+	fl = __builtin_ctz(map);
+	return ((fl << SL_SHIFT) | __builtin_ctz(arenap->sl_bitmapp[fl]));
 }
 
 /*
@@ -642,25 +3751,56 @@ static int freelistindex(size_t size) {
  */
 static struct block_list*
 remove_free(void* blockp) {
-	int size = GET_SIZE(HDRP(blockp));
+	size_t size = GET_SIZE(HDRP(blockp));
 	int index = freelistindex(size);
 	struct block_list *removep = (struct block_list*) blockp;
 
+	arenap->free_bytes -= size;
+	arenap->free_hash[index >> SL_SHIFT] -= CHECK_HASH(blockp);
+	if ((uintptr_t)blockp < (uintptr_t)arenap->check_curp) {
+		arenap->check_hash[index >> SL_SHIFT] -= CHECK_HASH(blockp);
+		arenap->check_bytes -= size;
+	}
+
 	/* Making sure the removed block's neighbors point to the right blocks */
-	if(removep->next_list == NULL && removep->prev_list == NULL) {
-		/* Blockp is the only element in freelist[index] */
-		free_list_segregatedp[index] = NULL;
-	} else if(removep->next_list != NULL && removep->prev_list != NULL) {
-		/* Blockp is neither the head, nor the tail */
-		removep->next_list->prev_list = removep->prev_list;
-		removep->prev_list->next_list = removep->next_list;
-	} else if(removep->next_list != NULL && removep->prev_list == NULL) {
-		/* Blockp is the head, but not the only element */
-		free_list_segregatedp[index] = removep->next_list;
-		free_list_segregatedp[index]->prev_list = NULL;
+	if (IS_TREE(index)) {
+		/* Blockp is a node of the tree */
+		tree_remove(removep);
 	} else {
-		/* Blockp is the tail, but not the only element */
-		removep->prev_list->next_list = NULL;
+		struct block_list *nextp = NEXT_FREE(removep);
+		struct block_list *prevp = PREV_FREE(removep);
+
+#if MM_HARDEN
+		/* Both neighbors must be blocks that point back at blockp. */
+		if (!harden_link(nextp) || !harden_link(prevp) ||
+		    (nextp != NULL && PREV_FREE(nextp) != removep) ||
+		    (prevp != NULL ? NEXT_FREE(prevp) :
+		    arenap->free_list_segregatedp[index]) != removep)
+			harden_fail("corrupt free list", blockp);
+#endif
+		if (nextp == NULL && prevp == NULL) {
+			/* Blockp is the only element in freelist[index] */
+			arenap->free_list_segregatedp[index] = NULL;
+		} else if (nextp != NULL && prevp != NULL) {
+			/* Blockp is neither the head, nor the tail */
+			SET_PREV_FREE(nextp, prevp);
+			SET_NEXT_FREE(prevp, nextp);
+		} else if (nextp != NULL) {
+			/* Blockp is the head, but not the only element */
+			arenap->free_list_segregatedp[index] = nextp;
+			SET_PREV_FREE(nextp, NULL);
+		} else {
+			/* Blockp is the tail, but not the only element */
+			SET_NEXT_FREE(prevp, NULL);
+		}
+	}
+
+	/* Keep the bitmaps in step once the list or tree is empty */
+	if (arenap->free_list_segregatedp[index] == NULL) {
+		arenap->sl_bitmapp[index >> SL_SHIFT] &=
+		    ~(1u << (index & (SL_COUNT - 1)));
+		if (arenap->sl_bitmapp[index >> SL_SHIFT] == 0)
+			arenap->fl_bitmap &= ~(1u << (index >> SL_SHIFT));
 	}
 
 	return removep;
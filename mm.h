@@ -1,3 +1,85 @@
+/*
+ * mm.h - The interface of the memory allocator in mm.c: its build options,
+ *     the counters and heap snapshots it reports, and its entry points.
+ */
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Build options for the allocator.  Each one defaults to off and can be
+ * turned on from the command line, e.g., "make MMFLAGS=-DMM_TLSF=1".
+ */
+#ifndef MM_TLSF
+#define MM_TLSF 0	/* Two-level segregated fit with O(1) good fit. */
+#endif
+#ifndef MM_DEFER
+#define MM_DEFER 0	/* Deferred coalescing through quick lists. */
+#endif
+#ifndef MM_THREADS
+#define MM_THREADS 0	/* Thread-safe heap with per-thread caches. */
+#endif
+#ifndef MM_STATS
+#define MM_STATS 0	/* Allocation statistics for mm_stats(). */
+#endif
+#ifndef MM_PLACE
+#define MM_PLACE 0	/* Cache-line-aware placement of small and large blocks. */
+#endif
+#ifndef MM_HARDEN
+#define MM_HARDEN 0	/* Safe-linking and constant time checks on free. */
+#endif
+#ifndef MM_CANARY
+#define MM_CANARY 0	/* A canary word at the end of every block. */
+#endif
+
+/*
+ * Counters returned by mm_stats().  Per-class counters are indexed by the
+ * power-of-two size class of the block involved, i.e., class i holds
+ * blocks of (2^(i+4), 2^(i+5)] bytes, with the first and last classes
+ * open-ended.  Every counter is zero unless mm.c is built with MM_STATS.
+ */
+#define MM_NCLASSES 12
+
+struct mm_stats {
+	size_t	allocs[MM_NCLASSES];	/* Blocks allocated. */
+	size_t	frees[MM_NCLASSES];	/* Blocks freed. */
+	size_t	fit_searches[MM_NCLASSES]; /* find_fit calls. */
+	size_t	fit_walks[MM_NCLASSES];	/* Free blocks find_fit looked at. */
+	size_t	splits[MM_NCLASSES];	/* Free blocks split by placement. */
+	size_t	coalesces[MM_NCLASSES];	/* Merges, by class of the result. */
+	size_t	extend_calls;		/* extend_heap calls. */
+	size_t	extend_bytes;		/* Bytes extend_heap added. */
+	size_t	peak_heap;		/* Largest mem_heapsize() seen. */
+};
+
+/*
+ * mm_snapshot() writes the layout of the heap to a stream as a struct
+ * mm_snap, followed for each arena by a struct mm_snap_arena and one word
+ * per block in address order, so that a block's address is the arena's
+ * start plus the sizes of the blocks before it.  A word holds the block's
+ * size, its MM_SNAP_* flags in the low bits, and the index of the list the
+ * block is on in the top byte, if it is free.
+ */
+#define MM_SNAP_MAGIC  0x70616e73	/* "snap" */
+#define MM_SNAP_ALLOC  0x1	/* Block is allocated. */
+#define MM_SNAP_SLAB   0x2	/* Block is a slab page. */
+#define MM_SNAP_QUICK  0x4	/* Block is free on a quick list. */
+#define MM_SNAP_SIZE(w)  ((w) & 0x00fffffffffffff8ULL)
+#define MM_SNAP_LIST(w)  ((unsigned)((w) >> 56))
+
+struct mm_snap {
+	uint32_t magic;		/* MM_SNAP_MAGIC. */
+	uint32_t narenas;	/* Number of arenas that follow. */
+	uint64_t label;		/* Caller's label, e.g., a request number. */
+	uint64_t heap_size;	/* mem_heapsize(), including huge blocks. */
+	uint64_t huge_blocks;	/* Huge blocks mapped on their own. */
+	uint64_t huge_bytes;	/* Bytes mapped for them. */
+};
+
+struct mm_snap_arena {
+	uint64_t start;		/* Address of the arena's first block. */
+	uint64_t nblocks;	/* Number of block words that follow. */
+};
+
 /*
  * The public interface to the students' memory allocator.
  */
@@ -6,6 +88,19 @@ int	 mm_init(void);
 void	*mm_malloc(size_t size);
 void	 mm_free(void *ptr);
 void	*mm_realloc(void *ptr, size_t size);
+void	*mm_calloc(size_t nmemb, size_t size);
+void	*mm_memalign(size_t alignment, size_t size);
+void	*mm_aligned_alloc(size_t alignment, size_t size);
+void	 mm_free_sized(void *ptr, size_t size);
+size_t	 mm_malloc_batch(size_t size, size_t n, void **out);
+void	 mm_free_batch(void **ptrs, size_t n);
+void	 mm_thread_exit(void);
+size_t	 mm_usable_size(void *ptr);
+void	 mm_shrink_to_fit(void *ptr, size_t size);
+size_t	 mm_trim(size_t pad);
+void	 mm_stats(struct mm_stats *stats);
+int	 mm_snapshot(FILE *fp, uint64_t label);
+size_t	 mm_check(size_t budget);
 
 /*
  * Students work in teams of one or two.  Teams enter their team name, personal
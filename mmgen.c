@@ -0,0 +1,514 @@
+/*
+ * mmgen.c - Generates synthetic traces for mdriver, from a few thousand
+ *     requests up to a billion, with a chosen size distribution, object
+ *     lifetime and live set.
+ *
+ * Every allocated object is given a time of death when it is allocated,
+ * drawn from the lifetime distribution, and objects are freed in order of
+ * death with a min-heap.  The mean lifetime is set from the live set size
+ * by Little's law, so that the number of live objects settles around -L.
+ * A realloc either grows the last reallocated object again, making a
+ * growth chain, or resizes a random live object.  The last requests free
+ * whatever is still live, so the heap ends up empty.
+ *
+ * Ids of freed objects are reused, so a trace has about as many ids as
+ * its peak live set, and the output is written as it is generated: text
+ * if the name ends in .rep, otherwise the binary format of trace.h.
+ *
+ * usage: mmgen [options] <out.rep|out.bin>
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define CHUNKOPS   4096  /* binary requests written at a time */
+
+/* Size distributions */
+enum {FIXED, UNIFORM, POWER, BIMODAL};
+
+/* Lifetime distributions */
+enum {LIFE_EXP, LIFE_FIXED, LIFE_UNIFORM};
+
+/* A live object; its id is its index in objs */
+typedef struct {
+    uint64_t death;  /* request at which the object is freed */
+    uint32_t size;   /* current size of the object */
+    uint32_t lpos;   /* position of the object in live */
+} obj_t;
+
+/* Generator parameters */
+static uint64_t nops = 100000;   /* requests in the trace */
+static uint64_t target = 1000;   /* live objects once warmed up */
+static int dist = POWER;         /* size distribution and its parameters */
+static double dmin = 8, dmax = 4096, dparam = 1.5, dprob = 0.5;
+static int life = LIFE_EXP;      /* lifetime distribution */
+static double p_realloc = 0.05;  /* probability of a realloc */
+static double growth = 1.5;      /* growth factor of a realloc chain */
+static double p_chain = 0.75;    /* probability that a chain goes on */
+static uint32_t max_size = 1 << 20;  /* cap on any size */
+static uint64_t seed = 1;
+
+/* Generator state */
+static obj_t *objs;          /* objects by id */
+static uint32_t *heap;       /* live ids, min-heap by death */
+static uint32_t *live;       /* live ids, in no order */
+static uint32_t *spare;      /* stack of freed ids */
+static uint32_t nlive, nspare, num_ids, cap;
+static int64_t chain = -1;   /* id the last realloc grew, -1 if none */
+static uint64_t rng;
+
+/* Totals for the summary */
+static uint64_t counts[3], live_bytes, peak_bytes, peak_live;
+
+/* Output */
+static FILE *out;
+static int binary;
+static traceop_t ops[CHUNKOPS];
+static int nbuf;
+
+static void usage(void);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+/*
+ * next_rand - Return the next 64 random bits (xorshift64*)
+ */
+static uint64_t next_rand(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return rng * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * uniform - Return a random double in (0, 1]
+ */
+static double uniform(void)
+{
+    return ((next_rand() >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * clamp_size - Return size rounded and limited to [1, max_size]
+ */
+static uint32_t clamp_size(double size)
+{
+    if (size < 1)
+	return 1;
+    if (size >= max_size)
+	return max_size;
+    return (uint32_t)(size + 0.5);
+}
+
+/*
+ * get_size - Return a random size from the size distribution
+ */
+static uint32_t get_size(void)
+{
+    double u = uniform(), a;
+
+    switch (dist) {
+    case FIXED:
+	return clamp_size(dmin);
+    case UNIFORM:
+	return clamp_size(dmin + next_rand() % (uint64_t)(dmax - dmin + 1));
+    case POWER:
+	/* Invert the CDF of a density proportional to x^-alpha */
+	if (fabs(dparam - 1) < 1e-9)
+	    return clamp_size(dmin * pow(dmax / dmin, u));
+	a = 1 - dparam;
+	return clamp_size(pow(pow(dmin, a) + u * (pow(dmax, a) -
+						  pow(dmin, a)), 1 / a));
+    default:
+	return clamp_size(u <= dprob ? dmin : dmax);
+    }
+}
+
+/*
+ * get_lifetime - Return a random lifetime in requests
+ */
+static uint64_t get_lifetime(void)
+{
+    double mean = 2.0 * target / (1 - p_realloc);
+    double t;
+
+    switch (life) {
+    case LIFE_FIXED:
+	t = mean;
+	break;
+    case LIFE_UNIFORM:
+	t = 2 * mean * uniform();
+	break;
+    default:
+	t = -mean * log(uniform());
+    }
+    return (uint64_t)t + 1;
+}
+
+/*
+ * emit - Write one request to the trace
+ */
+static void emit(int type, uint32_t id, uint32_t size)
+{
+    counts[type]++;
+    if (!binary) {
+	if (type == FREE)
+	    fprintf(out, "f %u\n", id);
+	else
+	    fprintf(out, "%c %u %u\n", type == ALLOC ? 'a' : 'r', id, size);
+	return;
+    }
+    ops[nbuf].type = type;
+    ops[nbuf].index = id;
+    ops[nbuf].size = size;
+    if (++nbuf == CHUNKOPS) {
+	if (fwrite(ops, sizeof(traceop_t), nbuf, out) != (size_t)nbuf)
+	    unix_error("fwrite failed for the requests");
+	nbuf = 0;
+    }
+}
+
+/*
+ * resize - Change the size of a live object, tracking the bytes live
+ */
+static void resize(uint32_t id, uint32_t size)
+{
+    live_bytes += size;
+    live_bytes -= objs[id].size;
+    objs[id].size = size;
+    if (live_bytes > peak_bytes)
+	peak_bytes = live_bytes;
+}
+
+/*
+ * do_alloc - Allocate a new object that dies lifetime requests from now
+ */
+static void do_alloc(uint64_t now)
+{
+    uint32_t id, i, parent;
+
+    if (nspare > 0)
+	id = spare[--nspare];
+    else {
+	if (num_ids == TRACE_MAXIDS)
+	    app_error("ERROR: too many live objects for the trace format");
+	if (num_ids == cap) {
+	    cap = cap ? 2 * cap : 1024;
+	    if ((objs = realloc(objs, cap * sizeof(obj_t))) == NULL ||
+		(heap = realloc(heap, cap * sizeof(uint32_t))) == NULL ||
+		(live = realloc(live, cap * sizeof(uint32_t))) == NULL ||
+		(spare = realloc(spare, cap * sizeof(uint32_t))) == NULL)
+		unix_error("realloc failed for the objects");
+	}
+	id = num_ids++;
+    }
+    objs[id].death = now + get_lifetime();
+    objs[id].size = 0;
+    resize(id, get_size());
+    objs[id].lpos = nlive;
+    live[nlive] = id;
+
+    /* Sift the object up the heap; nlive is also the heap size */
+    for (i = nlive++; i > 0; i = parent) {
+	parent = (i - 1) / 2;
+	if (objs[heap[parent]].death <= objs[id].death)
+	    break;
+	heap[i] = heap[parent];
+    }
+    heap[i] = id;
+    if (nlive > peak_live)
+	peak_live = nlive;
+    emit(ALLOC, id, objs[id].size);
+}
+
+/*
+ * do_free - Free the object that dies first
+ */
+static void do_free(void)
+{
+    uint32_t id = heap[0], last, i, child;
+
+    /* Sift the last object down from the top of the heap */
+    last = heap[--nlive];
+    for (i = 0; (child = 2 * i + 1) < nlive; i = child) {
+	if (child + 1 < nlive &&
+	    objs[heap[child + 1]].death < objs[heap[child]].death)
+	    child++;
+	if (objs[last].death <= objs[heap[child]].death)
+	    break;
+	heap[i] = heap[child];
+    }
+    heap[i] = last;
+
+    /* Swap it out of the live list and put its id aside for reuse */
+    live[objs[id].lpos] = live[nlive];
+    objs[live[nlive]].lpos = objs[id].lpos;
+    resize(id, 0);
+    spare[nspare++] = id;
+    if (chain == id)
+	chain = -1;
+    emit(FREE, id, 0);
+}
+
+/*
+ * do_realloc - Grow the object of the current chain, or resize a random
+ *     live object, which may start a new chain
+ */
+static void do_realloc(void)
+{
+    uint32_t id, size;
+
+    if (chain >= 0 && uniform() <= p_chain) {
+	id = chain;
+	size = clamp_size(objs[id].size * growth);
+    }
+    else {
+	id = live[next_rand() % nlive];
+	size = get_size();
+    }
+    chain = size > objs[id].size ? (int64_t)id : -1;
+    resize(id, size);
+    emit(REALLOC, id, size);
+}
+
+/*
+ * write_header - Write the trace header at the start of the file; a text
+ *     header has fixed-width fields so that it can be written over later
+ */
+static void write_header(void)
+{
+    tracehdr_t hdr;
+
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    hdr.sugg_heapsize = peak_bytes > UINT32_MAX ? UINT32_MAX : peak_bytes;
+    hdr.num_ids = num_ids;
+    hdr.num_ops = nops;
+    hdr.weight = 1;
+
+    if (fseek(out, 0, SEEK_SET) != 0)
+	unix_error("fseek failed for the trace header");
+    if (binary) {
+	if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	    unix_error("fwrite failed for the header");
+    }
+    else
+	fprintf(out, "%10u\n%10u\n%10u\n%10u\n", hdr.sugg_heapsize,
+		hdr.num_ids, hdr.num_ops, hdr.weight);
+}
+
+/*
+ * parse_count - Return the number in s, with an optional k, M or G
+ *     suffix for thousands, millions or billions
+ */
+static uint64_t parse_count(char *s)
+{
+    char *end;
+    double n = strtod(s, &end);
+
+    switch (*end) {
+    case 'k': case 'K': n *= 1e3; end++; break;
+    case 'M': case 'm': n *= 1e6; end++; break;
+    case 'G': case 'g': n *= 1e9; end++; break;
+    }
+    if (end == s || *end != '\0' || n < 0)
+	app_error("ERROR: bad count");
+    return (uint64_t)n;
+}
+
+/*
+ * parse_size - Return the byte size in s, with an optional K, M or G
+ *     suffix for powers of 1024
+ */
+static uint64_t parse_size(char *s)
+{
+    char *end;
+    uint64_t size = strtoull(s, &end, 10);
+
+    switch (*end) {
+    case 'G': case 'g':
+	size <<= 10;
+	/* fall through */
+    case 'M': case 'm':
+	size <<= 10;
+	/* fall through */
+    case 'K': case 'k':
+	size <<= 10;
+	end++;
+    }
+    if (end == s || *end != '\0' || size > UINT32_MAX)
+	app_error("ERROR: bad size");
+    return size;
+}
+
+/*
+ * parse_dist - Set the size distribution from its description
+ */
+static void parse_dist(char *s)
+{
+    if (sscanf(s, "fixed:%lf", &dmin) == 1)
+	dist = FIXED;
+    else if (sscanf(s, "uniform:%lf:%lf", &dmin, &dmax) == 2)
+	dist = UNIFORM;
+    else if (sscanf(s, "power:%lf:%lf:%lf", &dmin, &dmax, &dparam) == 3)
+	dist = POWER;
+    else if (sscanf(s, "bimodal:%lf:%lf:%lf", &dmin, &dmax, &dprob) == 3)
+	dist = BIMODAL;
+    else
+	app_error("ERROR: bad size distribution");
+    if (dmin < 1 || (dist != FIXED && dmax < dmin) || dparam <= 0 ||
+	dprob < 0 || dprob > 1)
+	app_error("ERROR: bad size distribution parameters");
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t now, rem;
+    int c;
+    size_t len;
+
+    while ((c = getopt(argc, argv, "n:L:d:t:r:g:c:m:s:h")) != EOF) {
+	switch (c) {
+	case 'n':
+	    nops = parse_count(optarg);
+	    break;
+	case 'L':
+	    target = parse_count(optarg);
+	    break;
+	case 'd':
+	    parse_dist(optarg);
+	    break;
+	case 't':
+	    if (!strcmp(optarg, "exp"))
+		life = LIFE_EXP;
+	    else if (!strcmp(optarg, "fixed"))
+		life = LIFE_FIXED;
+	    else if (!strcmp(optarg, "uniform"))
+		life = LIFE_UNIFORM;
+	    else
+		app_error("ERROR: bad lifetime distribution");
+	    break;
+	case 'r':
+	    p_realloc = atof(optarg);
+	    break;
+	case 'g':
+	    growth = atof(optarg);
+	    break;
+	case 'c':
+	    p_chain = atof(optarg);
+	    break;
+	case 'm':
+	    max_size = parse_size(optarg);
+	    break;
+	case 's':
+	    seed = parse_count(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind != argc - 1)
+	usage();
+    if (nops == 0 || nops > UINT32_MAX)
+	app_error("ERROR: the trace needs 1 to 2^32-1 requests");
+    if (target == 0 || p_realloc < 0 || p_realloc >= 1 || growth < 1 ||
+	max_size == 0)
+	app_error("ERROR: bad generator parameters");
+
+    len = strlen(argv[optind]);
+    binary = len < 4 || strcmp(argv[optind] + len - 4, ".rep") != 0;
+    if ((out = fopen(argv[optind], binary ? "wb" : "w")) == NULL)
+	unix_error("fopen failed for the trace");
+    write_header();
+
+    /* Seed xorshift with a splitmix64 step, so that no seed gives 0 */
+    rng = seed + 0x9e3779b97f4a7c15ULL;
+    rng = (rng ^ (rng >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    rng = (rng ^ (rng >> 27)) * 0x94d049bb133111ebULL;
+    rng ^= rng >> 31;
+    if (rng == 0)
+	rng = 1;
+
+    for (now = 0; now < nops; now++) {
+	rem = nops - now;
+	if (rem <= nlive)
+	    do_free();  /* drain the heap */
+	else if (rem == nlive + 1 && nlive > 0)
+	    do_realloc();  /* an alloc here would leave an object live */
+	else if (nlive > 0 && objs[heap[0]].death <= now)
+	    do_free();
+	else if (nlive > 0 && uniform() <= p_realloc)
+	    do_realloc();
+	else
+	    do_alloc(now);
+    }
+
+    if (binary && nbuf > 0 &&
+	fwrite(ops, sizeof(traceop_t), nbuf, out) != (size_t)nbuf)
+	unix_error("fwrite failed for the requests");
+    write_header();
+    if (fclose(out) != 0)
+	unix_error("fclose failed for the trace");
+
+    fprintf(stderr, "%s: %llu requests (%llu alloc, %llu free, "
+	    "%llu realloc), %u ids\n", argv[optind],
+	    (unsigned long long)nops, (unsigned long long)counts[ALLOC],
+	    (unsigned long long)counts[FREE],
+	    (unsigned long long)counts[REALLOC], num_ids);
+    fprintf(stderr, "peak live: %llu objects, %llu bytes\n",
+	    (unsigned long long)peak_live, (unsigned long long)peak_bytes);
+    exit(0);
+}
+
+/*
+ * usage - Explain the command line arguments
+ */
+static void usage(void)
+{
+    fprintf(stderr, "Usage: mmgen [-n <n>] [-L <n>] [-d <dist>] "
+	    "[-t exp|fixed|uniform] [-r <p>]\n"
+	    "             [-g <f>] [-c <p>] [-m <size>] [-s <seed>] "
+	    "<out.rep|out.bin>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n <n>     Requests in the trace, k, M or G "
+	    "suffix allowed (100k).\n");
+    fprintf(stderr, "\t-L <n>     Live objects once warmed up (1000).\n");
+    fprintf(stderr, "\t-d <dist>  Sizes: fixed:<s>, uniform:<min>:<max>,\n"
+	    "\t           power:<min>:<max>:<alpha> or "
+	    "bimodal:<s1>:<s2>:<p of s1>\n"
+	    "\t           (power:8:4096:1.5).\n");
+    fprintf(stderr, "\t-t <dist>  Lifetimes: exponential, fixed or "
+	    "uniform (exp).\n");
+    fprintf(stderr, "\t-r <p>     Probability that a request is a "
+	    "realloc (0.05).\n");
+    fprintf(stderr, "\t-g <f>     Growth factor of a realloc chain (1.5).\n");
+    fprintf(stderr, "\t-c <p>     Probability that a chain goes on "
+	    "(0.75).\n");
+    fprintf(stderr, "\t-m <size>  Largest size of any request (1M).\n");
+    fprintf(stderr, "\t-s <seed>  Seed of the random numbers (1).\n");
+    exit(1);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    fprintf(stderr, "%s\n", msg);
+    exit(1);
+}
@@ -0,0 +1,169 @@
+/*
+ * mmsnap.c - Analyzer for the heap snapshots written by mm_snapshot(),
+ *     e.g., with "mdriver -s <n>".
+ *
+ * For every snapshot in the file, prints the heap size, the allocated and
+ * free bytes, the largest free block and the external fragmentation, i.e.,
+ * the share of free bytes outside the largest free block.  Then prints the
+ * free bytes of each size class over time.
+ *
+ * usage: mmsnap <file>
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mm.h"
+
+#define CHUNKWORDS 1024  /* block words read at a time */
+
+/* Summarizes one snapshot */
+typedef struct {
+    uint64_t label;                  /* requests done, for mdriver */
+    uint64_t heap_size;              /* bytes, including huge blocks */
+    uint64_t alloc_bytes;            /* bytes in allocated blocks */
+    uint64_t slab_bytes;             /* ... of which in slab pages */
+    uint64_t free_bytes;             /* bytes in free blocks */
+    uint64_t quick_bytes;            /* ... of which on quick lists */
+    uint64_t largest_free;           /* largest free block */
+    uint64_t huge_bytes;             /* bytes mapped for huge blocks */
+    uint64_t class_free[MM_NCLASSES]; /* free bytes by size class */
+} summary_t;
+
+static int read_snapshot(FILE *fp, summary_t *sum);
+static int size_class(uint64_t size);
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    summary_t *sums = NULL, sum;
+    size_t n = 0, i;
+    double extfrag;
+    FILE *fp;
+    int k;
+
+    if (argc != 2) {
+	fprintf(stderr, "Usage: mmsnap <file>\n");
+	exit(1);
+    }
+    if ((fp = fopen(argv[1], "rb")) == NULL)
+	unix_error("fopen failed in main");
+    while (read_snapshot(fp, &sum)) {
+	if ((sums = realloc(sums, (n + 1) * sizeof(summary_t))) == NULL)
+	    unix_error("realloc failed in main");
+	sums[n++] = sum;
+    }
+    fclose(fp);
+
+    printf("%8s%9s%9s%9s%9s%9s%9s%9s\n", "ops", "heapKB", "allocKB",
+	   "slabKB", "freeKB", "quickKB", "largeKB", "extfrag");
+    for (i = 0; i < n; i++) {
+	extfrag = sums[i].free_bytes == 0 ? 0.0 :
+	    1.0 - (double)sums[i].largest_free / sums[i].free_bytes;
+	printf("%8llu%9llu%9llu%9llu%9llu%9llu%9llu%8.1f%%\n",
+	       (unsigned long long)sums[i].label,
+	       (unsigned long long)sums[i].heap_size / 1024,
+	       (unsigned long long)(sums[i].alloc_bytes +
+				    sums[i].huge_bytes) / 1024,
+	       (unsigned long long)sums[i].slab_bytes / 1024,
+	       (unsigned long long)sums[i].free_bytes / 1024,
+	       (unsigned long long)sums[i].quick_bytes / 1024,
+	       (unsigned long long)sums[i].largest_free / 1024,
+	       extfrag * 100.0);
+    }
+
+    printf("\nFree KB by size class:\n%8s", "ops");
+    for (k = 0; k < MM_NCLASSES; k++)
+	printf("%7d", k);
+    printf("\n");
+    for (i = 0; i < n; i++) {
+	printf("%8llu", (unsigned long long)sums[i].label);
+	for (k = 0; k < MM_NCLASSES; k++)
+	    printf("%7llu", (unsigned long long)sums[i].class_free[k] / 1024);
+	printf("\n");
+    }
+
+    free(sums);
+    exit(0);
+}
+
+/*
+ * read_snapshot - Read the next snapshot from fp and summarize it in sum.
+ *     Returns 1 if a snapshot was read and 0 at the end of the file.
+ */
+static int read_snapshot(FILE *fp, summary_t *sum)
+{
+    struct mm_snap snap;
+    struct mm_snap_arena arena;
+    uint64_t words[CHUNKWORDS], size;
+    size_t left, got, j;
+    uint32_t a;
+
+    if (fread(&snap, sizeof(snap), 1, fp) != 1)
+	return 0;
+    if (snap.magic != MM_SNAP_MAGIC)
+	app_error("ERROR: not a heap snapshot");
+
+    memset(sum, 0, sizeof(*sum));
+    sum->label = snap.label;
+    sum->heap_size = snap.heap_size;
+    sum->huge_bytes = snap.huge_bytes;
+    for (a = 0; a < snap.narenas; a++) {
+	if (fread(&arena, sizeof(arena), 1, fp) != 1)
+	    app_error("ERROR: truncated heap snapshot");
+	for (left = arena.nblocks; left > 0; left -= got) {
+	    got = left < CHUNKWORDS ? left : CHUNKWORDS;
+	    if (fread(words, sizeof(uint64_t), got, fp) != got)
+		app_error("ERROR: truncated heap snapshot");
+	    for (j = 0; j < got; j++) {
+		size = MM_SNAP_SIZE(words[j]);
+		if (words[j] & MM_SNAP_ALLOC) {
+		    sum->alloc_bytes += size;
+		    if (words[j] & MM_SNAP_SLAB)
+			sum->slab_bytes += size;
+		    continue;
+		}
+		sum->free_bytes += size;
+		if (words[j] & MM_SNAP_QUICK)
+		    sum->quick_bytes += size;
+		if (size > sum->largest_free)
+		    sum->largest_free = size;
+		sum->class_free[size_class(size)] += size;
+	    }
+	}
+    }
+    return 1;
+}
+
+/*
+ * size_class - Return the size class of a block of size bytes.  Class i
+ *     holds blocks of (2^(i+4), 2^(i+5)] bytes.
+ */
+static int size_class(uint64_t size)
+{
+    int k = 0;
+
+    while (k < MM_NCLASSES - 1 && size > (1ULL << (k + 5)))
+	k++;
+    return k;
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
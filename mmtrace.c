@@ -0,0 +1,669 @@
+/*
+ * mmtrace.c - An LD_PRELOAD library that records the malloc, calloc,
+ *     realloc and free calls of a running program as an mdriver trace.
+ *
+ *     MMTRACE=out.rep LD_PRELOAD=./libmmtrace.so program args...
+ *
+ * writes out.rep, or a binary trace (see trace.h) if the name ends in
+ * ".bin".  Programs that the traced program runs inherit MMTRACE, so a
+ * "%p" in the name, which is replaced by the process id, gives each of
+ * them a trace of its own.  Each thread appends a raw record per call to
+ * a ring buffer of its own, and a flusher thread copies the rings to
+ * "<out>.raw" every millisecond, so a call costs an increment of a shared
+ * sequence number and a store to the ring.  When the program exits the
+ * raw records are put back in sequence order, every block is given an id,
+ * as trace_t expects, and the trace is written.
+ *
+ * Ordering: free takes its sequence number before the block is freed and
+ * malloc takes its number after the block is allocated, so a block that
+ * one thread frees and another gets back is always freed first in the
+ * trace.  realloc takes one number before the call, for the old block,
+ * and one after it, for the new block.
+ *
+ * Calls made before the library is initialized, in a child after fork,
+ * or after the program's exit starts are not recorded.  Frees and
+ * reallocs of blocks that were never recorded are treated as unknown
+ * frees, which are dropped, and mallocs, respectively.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define RING_SIZE  8192       /* records per thread ring, a power of 2 */
+#define FLUSH_NS   1000000    /* nanoseconds between flushes */
+#define BOOT_SIZE  8192       /* bytes for dlsym's allocations */
+#define MAXLINE    1024       /* max string size */
+
+/* Kinds of raw record */
+enum {RAW_MALLOC, RAW_FREE, RAW_MOVE_OUT, RAW_MOVE_IN, RAW_MOVE_FAIL};
+
+/* One call, as the hooks record it */
+typedef struct {
+    uint64_t seq;             /* position in the program's call order */
+    uint64_t ptr;             /* block allocated or freed, or NULL */
+    uint64_t old;             /* RAW_MOVE_*: block passed to realloc */
+    uint64_t size;            /* RAW_MALLOC, RAW_MOVE_IN: bytes asked for */
+    uint32_t kind;            /* RAW_* */
+} rawrec_t;
+
+/* A single-producer single-consumer ring held by one thread at a time */
+typedef struct ring {
+    struct ring *next;        /* next ring on the list of all rings */
+    int owned;                /* held by a live thread */
+    uint64_t head __attribute__((aligned(64)));  /* next record to flush */
+    uint64_t tail __attribute__((aligned(64)));  /* next record to write */
+    rawrec_t recs[RING_SIZE] __attribute__((aligned(64)));
+} ring_t;
+
+/* Maps block addresses to trace ids during conversion */
+typedef struct {
+    uint64_t *keys;           /* block addresses, 0 for an empty slot */
+    uint32_t *vals;           /* trace ids */
+    size_t cap;               /* slots, a power of 2 */
+    size_t n;                 /* slots in use */
+} table_t;
+
+/* The allocator being traced */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+/* Serves dlsym's own allocations while the functions above are found */
+static char boot_buf[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+static int booting;
+
+/* Capture state */
+static int enabled;           /* record calls */
+static int failed;            /* records were lost */
+static int stopping;          /* tells the flusher to finish */
+static uint64_t next_seq;     /* next sequence number */
+static ring_t *rings;         /* list of all rings, newest first */
+static pthread_key_t ring_key;  /* releases a thread's ring at its exit */
+static pthread_t flush_thread;
+static int raw_fd = -1;
+static char out_path[MAXLINE];
+static char raw_path[MAXLINE];
+
+/* Per-thread state; initial-exec, so that no access ever allocates */
+static __thread ring_t *my_ring __attribute__((tls_model("initial-exec")));
+static __thread int in_hook __attribute__((tls_model("initial-exec")));
+
+static void find_real(void);
+static void record(uint32_t kind, void *ptr, void *old, size_t size);
+static ring_t *get_ring(void);
+static void release_ring(void *ring);
+static void *flusher(void *arg);
+static void flush_rings(void);
+static void stop_child(void);
+static void convert(void);
+static int write_trace(traceop_t *ops, uint32_t num_ops, uint32_t num_ids);
+static int rec_cmp(const void *a, const void *b);
+static int table_init(table_t *t);
+static void table_free(table_t *t);
+static int table_put(table_t *t, uint64_t key, uint32_t val);
+static int table_del(table_t *t, uint64_t key, uint32_t *val);
+
+/*
+ * The hooks
+ */
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (booting) {
+	size = (size + 15) & ~(size_t)15;
+	if (boot_used + size > BOOT_SIZE)
+	    return NULL;
+	boot_used += size;
+	return boot_buf + boot_used - size;
+    }
+    if (real_malloc == NULL)
+	find_real();
+    if ((p = real_malloc(size)) != NULL)
+	record(RAW_MALLOC, p, NULL, size);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (booting)  /* boot_buf is zero and never reused */
+	return malloc(nmemb * size);
+    if (real_calloc == NULL)
+	find_real();
+    if ((p = real_calloc(nmemb, size)) != NULL)
+	record(RAW_MALLOC, p, NULL, nmemb * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *p;
+
+    if (booting)
+	return NULL;
+    if (real_realloc == NULL)
+	find_real();
+    if ((char *)ptr >= boot_buf && (char *)ptr < boot_buf + BOOT_SIZE) {
+	if ((p = malloc(size)) != NULL)
+	    memcpy(p, ptr, size < (size_t)(boot_buf + BOOT_SIZE - (char *)ptr)
+		   ? size : (size_t)(boot_buf + BOOT_SIZE - (char *)ptr));
+	return p;
+    }
+    if (ptr == NULL)
+	return malloc(size);
+
+    record(RAW_MOVE_OUT, NULL, ptr, 0);
+    p = real_realloc(ptr, size);
+    if (p == NULL && size != 0)
+	record(RAW_MOVE_FAIL, ptr, ptr, 0);
+    else
+	record(RAW_MOVE_IN, p, ptr, size);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (ptr == NULL ||
+	((char *)ptr >= boot_buf && (char *)ptr < boot_buf + BOOT_SIZE))
+	return;
+    if (booting)
+	return;
+    if (real_free == NULL)
+	find_real();
+    record(RAW_FREE, ptr, NULL, 0);
+    real_free(ptr);
+}
+
+/*
+ * find_real - Look up the allocator that the hooks pass the calls on to
+ */
+static void find_real(void)
+{
+    booting = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    booting = 0;
+    if (!real_malloc || !real_calloc || !real_realloc || !real_free) {
+	fprintf(stderr, "mmtrace: cannot find the real allocator\n");
+	_exit(1);
+    }
+}
+
+/*
+ * record - Append a raw record of a call to the calling thread's ring.
+ *     The increment of next_seq can be relaxed: a free and the malloc
+ *     that gets the same block back are already ordered by the
+ *     allocator's own synchronization.
+ */
+static void record(uint32_t kind, void *ptr, void *old, size_t size)
+{
+    ring_t *r;
+    rawrec_t *rec;
+    uint64_t tail;
+
+    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED) || in_hook)
+	return;
+    in_hook = 1;
+    if ((r = get_ring()) != NULL) {
+	tail = r->tail;
+	while (tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_SIZE) {
+	    if (!__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+		in_hook = 0;  /* the flusher has given up */
+		return;
+	    }
+	    sched_yield();    /* full: wait for the flusher */
+	}
+	rec = &r->recs[tail & (RING_SIZE - 1)];
+	rec->seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+	rec->ptr = (uintptr_t)ptr;
+	rec->old = (uintptr_t)old;
+	rec->size = size;
+	rec->kind = kind;
+	__atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    in_hook = 0;
+}
+
+/*
+ * get_ring - Return the calling thread's ring, taking over the ring of a
+ *     thread that has exited or mapping a new one
+ */
+static ring_t *get_ring(void)
+{
+    ring_t *r;
+    int free_ring;
+
+    if (my_ring != NULL)
+	return my_ring;
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+	free_ring = 0;
+	if (__atomic_compare_exchange_n(&r->owned, &free_ring, 1, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	    break;
+    }
+    if (r == NULL) {
+	r = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED) {
+	    fprintf(stderr, "mmtrace: mmap failed, capture stopped\n");
+	    __atomic_store_n(&enabled, 0, __ATOMIC_RELAXED);
+	    failed = 1;
+	    return NULL;
+	}
+	r->owned = 1;
+	r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	    ;
+    }
+    my_ring = r;
+    pthread_setspecific(ring_key, r);
+    return r;
+}
+
+/*
+ * release_ring - Give up an exiting thread's ring.  Its records stay in
+ *     the ring until the flusher gets to them.
+ */
+static void release_ring(void *ring)
+{
+    my_ring = NULL;
+    __atomic_store_n(&((ring_t *)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * flusher - Copy the rings to the raw file until told to stop
+ */
+static void *flusher(void *arg)
+{
+    struct timespec ts = {0, FLUSH_NS};
+
+    (void)arg;
+    in_hook = 1;
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+	nanosleep(&ts, NULL);
+	flush_rings();
+    }
+    flush_rings();
+    return NULL;
+}
+
+/*
+ * flush_rings - Write the records in every ring to the raw file
+ */
+static void flush_rings(void)
+{
+    ring_t *r;
+    uint64_t head, tail, n;
+    ssize_t done;
+
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+	head = r->head;
+	tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	while (head < tail) {
+	    n = tail - head;
+	    if (n > RING_SIZE - (head & (RING_SIZE - 1)))
+		n = RING_SIZE - (head & (RING_SIZE - 1));
+	    done = write(raw_fd, &r->recs[head & (RING_SIZE - 1)],
+			 n * sizeof(rawrec_t));
+	    if (done <= 0 || done % sizeof(rawrec_t) != 0) {
+		fprintf(stderr, "mmtrace: write failed, capture stopped\n");
+		__atomic_store_n(&enabled, 0, __ATOMIC_RELAXED);
+		failed = 1;
+		return;
+	    }
+	    head += done / sizeof(rawrec_t);
+	    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+	}
+    }
+}
+
+/*
+ * stop_child - A child after fork has no flusher, so it records nothing
+ */
+static void stop_child(void)
+{
+    enabled = 0;
+    close(raw_fd);
+    raw_fd = -1;
+}
+
+/*
+ * mmtrace_init - Start capturing if MMTRACE names an output trace
+ */
+__attribute__((constructor))
+static void mmtrace_init(void)
+{
+    char *path, *pid;
+
+    if (real_malloc == NULL)
+	find_real();
+    if ((path = getenv("MMTRACE")) == NULL || *path == '\0')
+	return;
+    if (strlen(path) + 32 > MAXLINE) {
+	fprintf(stderr, "mmtrace: MMTRACE is too long\n");
+	return;
+    }
+    if ((pid = strstr(path, "%p")) != NULL)
+	sprintf(out_path, "%.*s%d%s", (int)(pid - path), path, (int)getpid(),
+		pid + 2);
+    else
+	strcpy(out_path, path);
+    sprintf(raw_path, "%s.raw", out_path);
+
+    in_hook = 1;
+    if ((raw_fd = open(raw_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+	perror("mmtrace: open failed");
+	in_hook = 0;
+	return;
+    }
+    if (pthread_key_create(&ring_key, release_ring) != 0 ||
+	pthread_atfork(NULL, NULL, stop_child) != 0 ||
+	pthread_create(&flush_thread, NULL, flusher, NULL) != 0) {
+	fprintf(stderr, "mmtrace: cannot start the flusher\n");
+	close(raw_fd);
+	unlink(raw_path);
+	in_hook = 0;
+	return;
+    }
+    in_hook = 0;
+    __atomic_store_n(&enabled, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * mmtrace_fini - Stop capturing, flush the rings and write the trace.
+ *     Calls still in flight in other threads may be missed.
+ */
+__attribute__((destructor))
+static void mmtrace_fini(void)
+{
+    if (raw_fd < 0)
+	return;
+    __atomic_store_n(&enabled, 0, __ATOMIC_RELEASE);
+    in_hook = 1;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(flush_thread, NULL);
+    close(raw_fd);
+    raw_fd = -1;
+    if (failed)
+	fprintf(stderr, "mmtrace: no trace written, records were lost\n");
+    else
+	convert();
+    in_hook = 0;
+}
+
+/*
+ * convert - Turn the raw records into trace requests and write the trace.
+ *     Ids are handed out densely in the order the blocks were allocated,
+ *     and a realloc keeps the id of the block it was passed.
+ */
+static void convert(void)
+{
+    rawrec_t *recs = MAP_FAILED, *rec;
+    traceop_t *ops = NULL;
+    table_t live, moving;
+    struct stat st;
+    size_t nrecs = 0, i;
+    uint32_t num_ids = 0, num_ops = 0, id, stale;
+    int fd, ok = 0;
+
+    if ((table_init(&live) | table_init(&moving)) < 0) {
+	fprintf(stderr, "mmtrace: out of memory\n");
+	goto out;
+    }
+    if ((fd = open(raw_path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	perror("mmtrace: cannot read the raw records");
+	goto out;
+    }
+    /* Sort a private copy-on-write mapping of the raw file in place */
+    nrecs = st.st_size / sizeof(rawrec_t);
+    if (nrecs > 0)
+	recs = mmap(NULL, nrecs * sizeof(rawrec_t), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (nrecs > 0 && recs == MAP_FAILED) {
+	perror("mmtrace: cannot map the raw records");
+	goto out;
+    }
+    if ((ops = malloc(nrecs * sizeof(traceop_t) + 1)) == NULL) {
+	fprintf(stderr, "mmtrace: out of memory\n");
+	goto out;
+    }
+    qsort(recs, nrecs, sizeof(rawrec_t), rec_cmp);
+
+    for (i = 0; i < nrecs; i++) {
+	rec = &recs[i];
+	if (rec->size > UINT32_MAX) {
+	    fprintf(stderr, "mmtrace: request of %llu bytes is too large\n",
+		    (unsigned long long)rec->size);
+	    goto out;
+	}
+	switch (rec->kind) {
+	case RAW_MALLOC:
+	    if (num_ids == TRACE_MAXIDS) {
+		fprintf(stderr, "mmtrace: too many blocks for a trace\n");
+		goto out;
+	    }
+	    /* A block we never saw freed was freed behind our back */
+	    table_del(&live, rec->ptr, &stale);
+	    if (table_put(&live, rec->ptr, num_ids) < 0)
+		goto out;
+	    ops[num_ops].type = ALLOC;
+	    ops[num_ops].index = num_ids++;
+	    ops[num_ops++].size = rec->size ? rec->size : 1;
+	    break;
+	case RAW_FREE:
+	    if (table_del(&live, rec->ptr, &id) < 0)
+		break;        /* allocated before capture started */
+	    ops[num_ops].type = FREE;
+	    ops[num_ops].index = id;
+	    ops[num_ops++].size = 0;
+	    break;
+	case RAW_MOVE_OUT:
+	    if (table_del(&live, rec->old, &id) == 0 &&
+		table_put(&moving, rec->old, id) < 0)
+		goto out;
+	    break;
+	case RAW_MOVE_FAIL:
+	    if (table_del(&moving, rec->old, &id) == 0 &&
+		table_put(&live, rec->old, id) < 0)
+		goto out;
+	    break;
+	case RAW_MOVE_IN:
+	    if (table_del(&moving, rec->old, &id) < 0) {
+		/* Unknown block: replay the realloc as a malloc */
+		if (rec->ptr == 0)
+		    break;
+		if (num_ids == TRACE_MAXIDS) {
+		    fprintf(stderr, "mmtrace: too many blocks for a trace\n");
+		    goto out;
+		}
+		table_del(&live, rec->ptr, &stale);
+		id = num_ids++;
+		ops[num_ops].type = ALLOC;
+	    } else if (rec->ptr == 0) {
+		ops[num_ops].type = FREE;  /* realloc(p, 0) freed p */
+		ops[num_ops].index = id;
+		ops[num_ops++].size = 0;
+		break;
+	    } else {
+		table_del(&live, rec->ptr, &stale);
+		ops[num_ops].type = REALLOC;
+	    }
+	    if (table_put(&live, rec->ptr, id) < 0)
+		goto out;
+	    ops[num_ops].index = id;
+	    ops[num_ops++].size = rec->size ? rec->size : 1;
+	    break;
+	}
+    }
+    ok = write_trace(ops, num_ops, num_ids) == 0;
+
+ out:
+    if (ok)
+	unlink(raw_path);
+    else
+	fprintf(stderr, "mmtrace: no trace written, raw records kept in %s\n",
+		raw_path);
+    if (recs != MAP_FAILED)
+	munmap(recs, nrecs * sizeof(rawrec_t));
+    free(ops);
+    table_free(&live);
+    table_free(&moving);
+}
+
+/*
+ * write_trace - Write the requests as a text or a binary trace, depending
+ *     on the name of the output file.  Returns 0 on success, -1 on error.
+ */
+static int write_trace(traceop_t *ops, uint32_t num_ops, uint32_t num_ids)
+{
+    tracehdr_t hdr;
+    size_t len = strlen(out_path);
+    uint32_t i;
+    FILE *fp;
+
+    if ((fp = fopen(out_path, "w")) == NULL) {
+	perror("mmtrace: cannot create the trace");
+	return -1;
+    }
+    if (len > 4 && strcmp(out_path + len - 4, ".bin") == 0) {
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.sugg_heapsize = 0;
+	hdr.num_ids = num_ids;
+	hdr.num_ops = num_ops;
+	hdr.weight = 1;
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(ops, sizeof(traceop_t), num_ops, fp);
+    } else {
+	fprintf(fp, "0\n%u\n%u\n1\n", num_ids, num_ops);
+	for (i = 0; i < num_ops; i++) {
+	    if (ops[i].type == FREE)
+		fprintf(fp, "f %u\n", (unsigned)ops[i].index);
+	    else
+		fprintf(fp, "%c %u %u\n", ops[i].type == ALLOC ? 'a' : 'r',
+			(unsigned)ops[i].index, ops[i].size);
+	}
+    }
+    if (ferror(fp) | fclose(fp)) {
+	perror("mmtrace: cannot write the trace");
+	return -1;
+    }
+    return 0;
+}
+
+/*
+ * rec_cmp - Order raw records by sequence number
+ */
+static int rec_cmp(const void *a, const void *b)
+{
+    uint64_t x = ((const rawrec_t *)a)->seq, y = ((const rawrec_t *)b)->seq;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * The address table: open addressing with linear probing, and deletion
+ * by shifting the following entries back, so there are no tombstones
+ */
+#define TABLE_SLOT(t, key) ((size_t)(((key) >> 4) * 0x9e3779b97f4a7c15ULL) \
+			    & ((t)->cap - 1))
+
+static int table_init(table_t *t)
+{
+    t->cap = 1024;
+    t->n = 0;
+    t->keys = calloc(t->cap, sizeof(uint64_t));
+    t->vals = malloc(t->cap * sizeof(uint32_t));
+    return (t->keys && t->vals) ? 0 : -1;
+}
+
+static void table_free(table_t *t)
+{
+    free(t->keys);
+    free(t->vals);
+    t->keys = NULL;
+    t->vals = NULL;
+}
+
+/*
+ * table_put - Map key (not 0) to val.  Returns 0 on success, -1 if the
+ *     table could not grow.
+ */
+static int table_put(table_t *t, uint64_t key, uint32_t val)
+{
+    table_t old;
+    size_t i;
+
+    if (2 * (t->n + 1) > t->cap) {
+	old = *t;
+	t->cap *= 2;
+	t->n = 0;
+	t->keys = calloc(t->cap, sizeof(uint64_t));
+	t->vals = malloc(t->cap * sizeof(uint32_t));
+	if (t->keys == NULL || t->vals == NULL) {
+	    fprintf(stderr, "mmtrace: out of memory\n");
+	    return -1;
+	}
+	for (i = 0; i < old.cap; i++)
+	    if (old.keys[i] != 0)
+		table_put(t, old.keys[i], old.vals[i]);
+	table_free(&old);
+    }
+    for (i = TABLE_SLOT(t, key); t->keys[i] != 0 && t->keys[i] != key;
+	 i = (i + 1) & (t->cap - 1))
+	;
+    if (t->keys[i] == 0)
+	t->n++;
+    t->keys[i] = key;
+    t->vals[i] = val;
+    return 0;
+}
+
+/*
+ * table_del - Remove key from the table and store its value in *val.
+ *     Returns 0 if the key was there and -1 if it was not.
+ */
+static int table_del(table_t *t, uint64_t key, uint32_t *val)
+{
+    size_t i, j, home;
+
+    for (i = TABLE_SLOT(t, key); t->keys[i] != key;
+	 i = (i + 1) & (t->cap - 1))
+	if (t->keys[i] == 0)
+	    return -1;
+    *val = t->vals[i];
+    t->n--;
+
+    /* Move back each following entry that may no longer be reachable */
+    for (j = (i + 1) & (t->cap - 1); t->keys[j] != 0;
+	 j = (j + 1) & (t->cap - 1)) {
+	home = TABLE_SLOT(t, t->keys[j]);
+	if (((j - home) & (t->cap - 1)) >= ((j - i) & (t->cap - 1))) {
+	    t->keys[i] = t->keys[j];
+	    t->vals[i] = t->vals[j];
+	    i = j;
+	}
+    }
+    t->keys[i] = 0;
+    return 0;
+}
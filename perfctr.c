@@ -0,0 +1,129 @@
+/*
+ * perfctr.c - Routines for counting hardware events with perf_event_open,
+ *     along the lines of the cycle counter routines in clock.c.
+ *
+ * Each event gets a counter of its own rather than a group, so that one
+ * event the CPU cannot count (under a hypervisor, say) does not lose the
+ * others.  Only user-level events of the calling process are counted,
+ * and counts are scaled up if the kernel had to multiplex the counters.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perfctr.h"
+
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+char *perfctr_names[NPERFCTRS] = {
+    "insns", "L1D", "LLC", "dTLB", "brmiss", "faults"
+};
+
+static const struct {
+    unsigned type;
+    unsigned long long config;
+} events[NPERFCTRS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL)},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static int fds[NPERFCTRS] = {-1, -1, -1, -1, -1, -1};
+static pid_t owner = 0;  /* process the counters count, 0 if none */
+
+/*
+ * open_perfctr - Open a counter for each event in the calling process,
+ *     returning how many could be opened
+ */
+static int open_perfctr(void)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < NPERFCTRS; i++) {
+	if (fds[i] >= 0)
+	    close(fds[i]);
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fds[i] >= 0)
+	    n++;
+    }
+    owner = getpid();
+    return n;
+}
+
+/*
+ * init_perfctr - Open the counters and, if verbose, tell which of the
+ *     events cannot be counted
+ */
+int init_perfctr(int verbose)
+{
+    int i, n = open_perfctr();
+
+    if (verbose) {
+	printf("Counting %d of %d events with perf_event", n, NPERFCTRS);
+	if (n < NPERFCTRS)
+	    printf(", not");
+	for (i = 0; i < NPERFCTRS; i++)
+	    if (fds[i] < 0)
+		printf(" %s", perfctr_names[i]);
+	printf(".\n");
+    }
+    return n;
+}
+
+/*
+ * start_perfctr - Reset and enable the counters.  A child after fork has
+ *     to open counters of its own, since inherited ones count the parent.
+ */
+void start_perfctr(void)
+{
+    int i;
+
+    if (owner != getpid())
+	open_perfctr();
+    for (i = 0; i < NPERFCTRS; i++) {
+	if (fds[i] < 0)
+	    continue;
+	ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+	ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+/*
+ * get_perfctr - Stop the counters and return the events counted since
+ *     start_perfctr in counts, or -1 for each event not counted
+ */
+void get_perfctr(double *counts)
+{
+    unsigned long long val[3];  /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < NPERFCTRS; i++)
+	if (fds[i] >= 0)
+	    ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < NPERFCTRS; i++) {
+	if (fds[i] < 0 || read(fds[i], val, sizeof(val)) != sizeof(val)) {
+	    counts[i] = -1;
+	    continue;
+	}
+	counts[i] = val[0];
+	if (val[2] != 0 && val[2] < val[1])
+	    counts[i] *= (double)val[1] / val[2];
+    }
+}
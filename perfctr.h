@@ -0,0 +1,22 @@
+/* Routines for using the hardware event counters through perf_event */
+
+/* Events counted, in this order */
+#define PERFCTR_INSNS    0   /* instructions retired */
+#define PERFCTR_L1D      1   /* L1 data cache read misses */
+#define PERFCTR_LLC      2   /* last level cache read misses */
+#define PERFCTR_DTLB     3   /* data TLB read misses */
+#define PERFCTR_BRANCH   4   /* mispredicted branches */
+#define PERFCTR_FAULTS   5   /* page faults */
+#define NPERFCTRS        6
+
+/* Short names of the events, for column headings */
+extern char *perfctr_names[NPERFCTRS];
+
+/* Open the counters; return how many of the events can be counted */
+int init_perfctr(int verbose);
+
+/* Start the counters */
+void start_perfctr(void);
+
+/* Get the events since the counters started, -1 for those not counted */
+void get_perfctr(double *counts);
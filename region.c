@@ -0,0 +1,274 @@
+/* 
+ * Regions layered on the mm allocator.  A region hands out memory by bumping
+ * a pointer through chunks that it gets from mm_malloc, and gives all of it
+ * back with one mm_free per chunk when it is destroyed.  Requests that would
+ * waste much of a chunk get a chunk of their own.
+ *
+ * Chunks grow geometrically from REGION_MINCHUNK to REGION_MAXCHUNK bytes,
+ * which keeps them below HUGE_THRESHOLD so that they come from the arenas.
+ * The region itself lives at the start of its first chunk.
+ *
+ * Resetting a region keeps its chunks for the allocations that follow, so a
+ * region reset on every iteration of a loop stops calling mm_malloc once it
+ * has grown to the loop's needs.  Regions nest: a region created inside
+ * another one is destroyed when its parent is destroyed or reset.
+ *
+ * A region may only be used by one thread at a time.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "mm.h"
+#include "region.h"
+
+/* Basic constants and macros: */
+#define ALIGN            16             /* Alignment of every allocation */
+#define REGION_MINCHUNK  (4 * 1024)     /* Size of the first chunk (bytes) */
+#define REGION_MAXCHUNK  (64 * 1024)    /* Largest shared chunk (bytes) */
+#define REGION_BIGSIZE   (REGION_MAXCHUNK / 4) /* Smallest own-chunk request */
+
+#define MAX(x, y)  ((x) > (y) ? (x) : (y))
+
+/* Round size up to the alignment. */
+#define ALIGN_UP(size)  (((size) + (ALIGN - 1)) & ~(size_t)(ALIGN - 1))
+
+/* Header at the start of every chunk, and the first byte after it. */
+struct region_chunk
+{
+	struct region_chunk *next;
+	size_t size;		/* Bytes in this chunk, including the header. */
+};
+#define CHUNK_HDRSIZE   ALIGN_UP(sizeof(struct region_chunk))
+#define CHUNK_DATA(cp)  ((char *)(cp) + CHUNK_HDRSIZE)
+#define CHUNK_END(cp)   ((char *)(cp) + (cp)->size)
+
+struct mm_region
+{
+	struct region_chunk *first;	/* Shared chunks, oldest first */
+	struct region_chunk *chunk;	/* Shared chunk being bumped through */
+	struct region_chunk *big;	/* Chunks of single large requests */
+	char *cur;			/* Next free byte of the chunk */
+	char *end;			/* End of the chunk */
+	size_t chunksize;		/* Size of the next new shared chunk */
+	struct mm_region *parent;	/* Enclosing region, or NULL */
+	struct mm_region *child;	/* First nested region */
+	struct mm_region *prev;		/* Siblings with the same parent */
+	struct mm_region *next;
+};
+
+/* First byte of the first chunk after the region itself. */
+#define REGION_DATA(rp)  \
+	(CHUNK_DATA((rp)->first) + ALIGN_UP(sizeof(struct mm_region)))
+
+/* Function prototypes for internal helper routines: */
+static struct region_chunk *chunk_new(size_t size);
+static void *region_grow(mm_region_t *region, size_t size);
+static void region_release(mm_region_t *region);
+
+/* 
+ * Requires:
+ *   "parent" is either a region or NULL.
+ *
+ * Effects:
+ *   Create an empty region, nested in "parent" unless "parent" is NULL.
+ *   Returns the region if successful and NULL otherwise.
+ */
+mm_region_t *
+mm_region_create(mm_region_t *parent)
+{
+	struct region_chunk *cp;
+	mm_region_t *region;
+
+	if ((cp = chunk_new(REGION_MINCHUNK)) == NULL)
+		return (NULL);
+	region = (mm_region_t *)CHUNK_DATA(cp);
+	region->first = cp;
+	region->chunk = cp;
+	region->big = NULL;
+	region->cur = REGION_DATA(region);
+	region->end = CHUNK_END(cp);
+	region->chunksize = 2 * REGION_MINCHUNK;
+	region->child = NULL;
+	region->prev = NULL;
+
+	/* Link the region into its parent's list of children. */
+	region->parent = parent;
+	region->next = NULL;
+	if (parent != NULL) {
+		region->next = parent->child;
+		if (parent->child != NULL)
+			parent->child->prev = region;
+		parent->child = region;
+	}
+	return (region);
+}
+
+/* 
+ * Requires:
+ *   "region" is a region.
+ *
+ * Effects:
+ *   Allocate at least "size" bytes from "region", aligned like mm_malloc's
+ *   blocks.  The memory lives until the region is reset or destroyed.
+ *   Returns its address if successful and NULL otherwise, or if "size" is
+ *   zero.
+ */
+void *
+mm_region_alloc(mm_region_t *region, size_t size)
+{
+	void *p;
+
+	/* Ignore spurious requests. */
+	if (size == 0 || size > SIZE_MAX - ALIGN)
+		return (NULL);
+	size = ALIGN_UP(size);
+
+	/* Bump through the current chunk if it has room. */
+	if (size <= (size_t)(region->end - region->cur)) {
+		p = region->cur;
+		region->cur += size;
+		return (p);
+	}
+	return (region_grow(region, size));
+}
+
+/* 
+ * Requires:
+ *   "region" is a region.
+ *
+ * Effects:
+ *   Throw away everything allocated from "region" and destroy the regions
+ *   nested in it, but keep its shared chunks for the allocations that
+ *   follow.  The chunks of single large requests are freed.
+ */
+void
+mm_region_reset(mm_region_t *region)
+{
+
+	region_release(region);
+	region->chunk = region->first;
+	region->cur = REGION_DATA(region);
+	region->end = CHUNK_END(region->first);
+}
+
+/* 
+ * Requires:
+ *   "region" is a region.
+ *
+ * Effects:
+ *   Destroy "region" and the regions nested in it, freeing all of their
+ *   memory.
+ */
+void
+mm_region_destroy(mm_region_t *region)
+{
+	struct region_chunk *cp, *next;
+
+	region_release(region);
+
+	/* Unlink the region from its parent's list of children. */
+	if (region->prev != NULL)
+		region->prev->next = region->next;
+	else if (region->parent != NULL)
+		region->parent->child = region->next;
+	if (region->next != NULL)
+		region->next->prev = region->prev;
+
+	/* The first chunk holds the region, so it goes last. */
+	for (cp = region->first->next; cp != NULL; cp = next) {
+		next = cp->next;
+		mm_free(cp);
+	}
+	mm_free(region->first);
+}
+
+/*
+ * The following routines are internal helper routines.
+ */
+
+/* 
+ * Requires:
+ *   "size" is larger than the chunk header.
+ *
+ * Effects:
+ *   Get a chunk of "size" bytes from mm_malloc.  Returns the chunk if
+ *   successful and NULL otherwise.
+ */
+static struct region_chunk *
+chunk_new(size_t size)
+{
+	struct region_chunk *cp;
+
+	if ((cp = mm_malloc(size)) == NULL)
+		return (NULL);
+	cp->next = NULL;
+	cp->size = size;
+	return (cp);
+}
+
+/* 
+ * Requires:
+ *   "size" is aligned and larger than the room left in the region's
+ *   current chunk.
+ *
+ * Effects:
+ *   Allocate "size" bytes from a chunk other than the current one.  A large
+ *   request gets a chunk of its own.  Otherwise, the region moves on to the
+ *   next kept chunk with enough room, or to a new chunk.  Returns the
+ *   address of the memory if successful and NULL otherwise.
+ */
+static void *
+region_grow(mm_region_t *region, size_t size)
+{
+	struct region_chunk *cp;
+
+	if (size >= REGION_BIGSIZE) {
+		if (size > SIZE_MAX - CHUNK_HDRSIZE ||
+		    (cp = chunk_new(CHUNK_HDRSIZE + size)) == NULL)
+			return (NULL);
+		cp->next = region->big;
+		region->big = cp;
+		return (CHUNK_DATA(cp));
+	}
+
+	/* Skip the kept chunks that are too small, then add a new one. */
+	cp = region->chunk;
+	while (cp->next != NULL && 
+	    (size_t)(CHUNK_END(cp->next) - CHUNK_DATA(cp->next)) < size)
+		cp = cp->next;
+	if (cp->next == NULL) {
+		cp->next = chunk_new(MAX(region->chunksize, CHUNK_HDRSIZE + size));
+		if (cp->next == NULL)
+			return (NULL);
+		if (region->chunksize < REGION_MAXCHUNK)
+			region->chunksize *= 2;
+	}
+	cp = cp->next;
+	region->chunk = cp;
+	region->cur = CHUNK_DATA(cp) + size;
+	region->end = CHUNK_END(cp);
+	return (CHUNK_DATA(cp));
+}
+
+/* 
+ * Requires:
+ *   "region" is a region.
+ *
+ * Effects:
+ *   Destroy the regions nested in "region" and free its chunks of single
+ *   large requests.
+ */
+static void
+region_release(mm_region_t *region)
+{
+	struct region_chunk *cp, *next;
+
+	while (region->child != NULL)
+		mm_region_destroy(region->child);
+	for (cp = region->big; cp != NULL; cp = next) {
+		next = cp->next;
+		mm_free(cp);
+	}
+	region->big = NULL;
+}
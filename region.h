@@ -0,0 +1,11 @@
+/*
+ * The public interface to regions, which bump-allocate from large blocks of
+ * the mm allocator and free everything allocated from them at once.
+ */
+
+typedef struct mm_region mm_region_t;
+
+mm_region_t	*mm_region_create(mm_region_t *parent);
+void		*mm_region_alloc(mm_region_t *region, size_t size);
+void		 mm_region_reset(mm_region_t *region);
+void		 mm_region_destroy(mm_region_t *region);
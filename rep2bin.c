@@ -0,0 +1,109 @@
+/*
+ * rep2bin.c - Converts a text .rep trace into the binary trace format of
+ *     trace.h, which mdriver maps and replays without parsing.
+ *
+ * The requests are streamed from one file to the other, so traces of any
+ * length can be converted.
+ *
+ * usage: rep2bin <in.rep> <out.bin>
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+#define MAXLINE    1024  /* max string size */
+#define CHUNKOPS   4096  /* requests written at a time */
+
+static void unix_error(char *msg);
+static void app_error(char *msg);
+
+int main(int argc, char **argv)
+{
+    traceop_t ops[CHUNKOPS];
+    tracehdr_t hdr;
+    char type[MAXLINE];
+    unsigned index, size;
+    unsigned max_index = 0;
+    uint32_t nops = 0, n = 0;
+    FILE *in, *out;
+
+    if (argc != 3) {
+	fprintf(stderr, "Usage: rep2bin <in.rep> <out.bin>\n");
+	exit(1);
+    }
+    if ((in = fopen(argv[1], "r")) == NULL)
+	unix_error("fopen failed for the text trace");
+    if ((out = fopen(argv[2], "wb")) == NULL)
+	unix_error("fopen failed for the binary trace");
+
+    hdr.magic = TRACE_MAGIC;
+    hdr.version = TRACE_VERSION;
+    if (fscanf(in, "%u %u %u %u", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4)
+	app_error("ERROR: bad trace header");
+    if (hdr.num_ids > TRACE_MAXIDS)
+	app_error("ERROR: too many ids for the binary format");
+    if (fwrite(&hdr, sizeof(hdr), 1, out) != 1)
+	unix_error("fwrite failed for the header");
+
+    while (fscanf(in, "%s", type) != EOF) {
+	size = 0;
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(in, "%u %u", &index, &size) != 2)
+		app_error("ERROR: bad alloc/realloc request");
+	    ops[n].type = type[0] == 'a' ? ALLOC : REALLOC;
+	    max_index = index > max_index ? index : max_index;
+	    break;
+	case 'f':
+	    if (fscanf(in, "%u", &index) != 1)
+		app_error("ERROR: bad free request");
+	    ops[n].type = FREE;
+	    break;
+	default:
+	    fprintf(stderr, "Bogus type character (%c) in %s\n",
+		    type[0], argv[1]);
+	    exit(1);
+	}
+	if (index >= hdr.num_ids)
+	    app_error("ERROR: request id out of range");
+	ops[n].index = index;
+	ops[n].size = size;
+	nops++;
+	if (++n == CHUNKOPS) {
+	    if (fwrite(ops, sizeof(traceop_t), n, out) != n)
+		unix_error("fwrite failed for the requests");
+	    n = 0;
+	}
+    }
+    if (fwrite(ops, sizeof(traceop_t), n, out) != n)
+	unix_error("fwrite failed for the requests");
+    if (nops != hdr.num_ops || max_index != hdr.num_ids - 1)
+	app_error("ERROR: trace header does not match its requests");
+
+    fclose(in);
+    if (fclose(out) != 0)
+	unix_error("fclose failed for the binary trace");
+    exit(0);
+}
+
+/*
+ * unix_error - Report a Unix-style error
+ */
+static void unix_error(char *msg)
+{
+    perror(msg);
+    exit(1);
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+static void app_error(char *msg)
+{
+    printf("%s\n", msg);
+    exit(1);
+}
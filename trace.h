@@ -0,0 +1,32 @@
+/*
+ * trace.h - The binary trace format that mdriver replays straight from a
+ *     memory mapping, as written by rep2bin from a text .rep trace.
+ *
+ * A binary trace is a tracehdr_t followed by num_ops traceop_t requests,
+ * all in the byte order of the machine that wrote it.
+ */
+#include <stdint.h>
+
+#define TRACE_MAGIC    0x72746d6d  /* "mmtr" */
+#define TRACE_VERSION  1
+#define TRACE_MAXIDS   (1U << 30)  /* ids must fit in traceop_t's index */
+
+/* Types of request */
+enum {ALLOC, FREE, REALLOC};
+
+/* Header at the start of every binary trace */
+typedef struct {
+    uint32_t magic;           /* TRACE_MAGIC */
+    uint32_t version;         /* TRACE_VERSION */
+    uint32_t sugg_heapsize;   /* suggested heap size (unused) */
+    uint32_t num_ids;         /* number of alloc/realloc ids */
+    uint32_t num_ops;         /* number of distinct requests */
+    uint32_t weight;          /* weight for this trace (unused) */
+} tracehdr_t;
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    uint32_t index : 30;      /* index for free() to use later */
+    uint32_t type : 2;        /* type of request */
+    uint32_t size;            /* byte size of alloc/realloc request */
+} traceop_t;